@@ -1,16 +1,39 @@
 #include "Built_ins.hpp"
+#include "Bytecode.hpp"
+#include "Image.hpp"
+#include "Pool.hpp"
 #include "Scheduler.hpp"
+#include "Simd.hpp"
+#include "Worker_pool.hpp"
 #include "Interpreter.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 void alias(Interpreter &s, const char *src, const char *dst) {
-    s.dict.emplace(std::pair(s.symtab.intern(dst), s.dict.find(s.symtab.intern(src))->second));
+    s.dict.define(s.symtab.intern(dst), *s.dict.find(s.symtab.intern(src)));
 }
 
 void print_value(Interpreter &s, const Value &v);
 
-void print_array(Interpreter &s, const std::vector<Value> &arr) {
+template <class Q>
+void print_queue(const char *name, const Q &q) {
+    std::cout << name << ": pushed " << q.pushed()
+        << " dropped " << q.dropped()
+        << " rejected " << q.rejected()
+        << " high-water " << q.high_water() << '/' << q.capacity() << '\n';
+}
+
+// Latencies are recorded in nanoseconds and printed in microseconds.
+void print_histogram(const char *name, const Histogram &h) {
+    std::cout << name << ": n " << h.count()
+        << " p50 " << h.percentile(50) / 1000.0 << "us"
+        << " p99 " << h.percentile(99) / 1000.0 << "us"
+        << " max " << h.max() / 1000.0 << "us\n";
+}
+
+void print_array(Interpreter &s, const Value::Elems &arr) {
     if (arr.empty()) {
         std::cout << "a{}";
     } else {
@@ -23,17 +46,39 @@ void print_array(Interpreter &s, const std::vector<Value> &arr) {
     }
 }
 
-void print_object(Interpreter &s, const std::unordered_map<Value, Value> map) {
-    if (map.empty()) {
+// Shared by boxed and packed numbers. NaNs print alike whatever their sign
+// bit, as boxing canonicalizes them.
+void print_number(double d) {
+    if (std::isnan(d))
+        std::cout << "nan";
+    else
+        std::cout << d;
+}
+
+void print_packed(const std::vector<double> &elems) {
+    if (elems.empty()) {
+        std::cout << "p{}";
+    } else {
+        std::cout << "p{";
+        for (double d : elems) {
+            std::cout << ' ';
+            print_number(d);
+        }
+        std::cout << " }";
+    }
+}
+
+void print_object(Interpreter &s, const Value &obj) {
+    if (obj.field_count() == 0) {
         std::cout << "o{}";
     } else {
         std::cout << "o{";
-        for (auto it = map.cbegin(), end = map.cend(); it != end; ++it) {
+        obj.for_each_field([&s](const Value &key, const Value &value) {
             std::cout << ' ';
-            print_value(s, it->first);
+            print_value(s, key);
             std::cout << " : ";
-            print_value(s, it->second);
-        }
+            print_value(s, value);
+        });
         std::cout << " }";
     }
 }
@@ -44,13 +89,13 @@ void print_value(Interpreter &s, const Value &v) {
         std::cout << '$';
         return;
     case VALUE_NUMBER:
-        std::cout << v.asDouble();
+        print_number(v.asDouble());
         return;
     case VALUE_SYMBOL:
         std::cout << '$' << s.symtab.symbol_string(v.asSymbol());
         return;
     case VALUE_BUILT_IN:
-        std::cout << s.symtab.symbol_string(*v.funcName());
+        std::cout << v.asBuiltIn()->name;
         return;
     case VALUE_DEFINED: {
           const Symbol *sym = v.funcName();
@@ -64,291 +109,467 @@ void print_value(Interpreter &s, const Value &v) {
         print_array(s, v.array_elems());
         break;
     case VALUE_OBJECT:
-        print_object(s, v.obj_fields());
+        print_object(s, v);
+        break;
+    case VALUE_PACKED:
+        print_packed(v.packed_elems());
         break;
     }
 }
 
-void load_built_ins(Interpreter& s) {
-    s.add_built_in("!", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value sym = s.pop();
-        if (sym.tag() != VALUE_SYMBOL) {
-            std::cout << "value is not a symbol in !\n";
-            return;
+void print_block_name(Interpreter &s, const Block_t *b) {
+    if (b->name == nullptr)
+        std::cout << "<CODE>";
+    else
+        std::cout << s.symtab.symbol_string(*b->name);
+}
+
+// One op per line, as run will execute them.
+void print_ops(Interpreter &s, const std::vector<Op> &ops) {
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const Op &op = ops[i];
+        std::cout << "  " << i << ' ' << op_name(op.code);
+        switch (op.code) {
+        case OP_PUSH_NUMBER:
+        case OP_ADD_NUMBER:
+        case OP_SUB_NUMBER:
+        case OP_MUL_NUMBER:
+        case OP_DIV_NUMBER:
+            std::cout << ' ' << op.number;
+            break;
+        case OP_PUSH_VALUE:
+            std::cout << ' ';
+            print_value(s, *op.value);
+            break;
+        case OP_CALL_BUILT_IN:
+            std::cout << ' ' << op.built_in->name;
+            break;
+        case OP_CALL_DEFINED:
+            std::cout << ' ';
+            print_block_name(s, op.block);
+            break;
         }
-        s.dict.insert_or_assign(sym.asSymbol(), x);
-    });
-    s.add_built_in("@", 1, [](Interpreter &s) {
-        Value x = s.pop();
-        if (x.tag() != VALUE_SYMBOL) {
-            std::cout << "value is not a symbol in @\n";
+        std::cout << '\n';
+    }
+}
+
+static Value truth(bool b) {
+    return b ? Value::fromDouble(1) : Value::nil();
+}
+
+// Reads a numeric index operand, reporting it if it is out of range.
+static bool index_in(const Value &i, std::size_t size, std::size_t &index, const char *name) {
+    double d = i.asDouble();
+    if (d < 0 || d >= size) {
+        std::cerr << "index out of range in " << name << '\n';
+        return false;
+    }
+    index = static_cast<std::size_t>(d);
+    return true;
+}
+
+// Elements each pmap chunk takes at least, so that handing out chunks
+// costs little next to running them.
+#define PMAP_MIN_CHUNK 64
+
+static bool numbers(const Value *args) {
+    return args[0].tag() == VALUE_NUMBER && args[1].tag() == VALUE_NUMBER;
+}
+
+// The elements of a packed array as an ordinary one, for when a value
+// that is not a number is stored into it.
+static Value unpacked(const Value &v) {
+    Value::Elems elems;
+    for (double d : v.packed_elems())
+        elems.push_back(Value::fromDouble(d));
+    return Value::from_vector(std::move(elems));
+}
+
+// Applies a SIMD_* op element-wise to two operands of which at least one
+// is packed, a number standing for every element. The top operand comes
+// first if top_first, as in - and /. The result overwrites an operand
+// that nothing else refers to, and only otherwise is allocated.
+static void packed_binary(Interpreter &s, Value *args, unsigned op, bool top_first, const char *name) {
+    const Value &x = args[top_first ? 1 : 0];
+    const Value &y = args[top_first ? 0 : 1];
+    bool x_packed = x.tag() == VALUE_PACKED;
+    bool y_packed = y.tag() == VALUE_PACKED;
+    std::size_t n = x_packed ? x.packed_elems().size() : y.packed_elems().size();
+    if (x_packed && y_packed && y.packed_elems().size() != n) {
+        std::cerr << "packed arrays differ in size in " << name << '\n';
+        s.drop(2);
+        return;
+    }
+    double x_number = x_packed ? 0 : x.asDouble();
+    double y_number = y_packed ? 0 : y.asDouble();
+    const double *xs = x_packed ? x.packed_elems().data() : &x_number;
+    const double *ys = y_packed ? y.packed_elems().data() : &y_number;
+    Value out = Value::nil();
+    if (x_packed && x.unique())
+        out = x;
+    else if (y_packed && y.unique())
+        out = y;
+    else
+        out = Value::packed(std::vector<double>(n));
+    simd_binary(op, xs, x_packed, ys, y_packed, out.packed_elems().data(), n);
+    s.replace_top(2, std::move(out));
+}
+
+// Mapping a packed array gives a packed array as long as the results are
+// numbers.
+static void map_values(Interpreter &s, Value &action, const Value &arr) {
+    Value::Elems new_array;
+    if (arr.tag() == VALUE_PACKED) {
+        std::vector<double> packed;
+        packed.reserve(arr.packed_elems().size());
+        bool all_numbers = true;
+        for (double d : arr.packed_elems()) {
+            s.push(Value::fromDouble(d));
+            s.exec_value(action);
+            if (s.unwinding)
+                return;
+            Value r = s.pop();
+            if (all_numbers && r.tag() == VALUE_NUMBER) {
+                packed.push_back(r.asDouble());
+                continue;
+            }
+            if (all_numbers) {
+                for (double p : packed)
+                    new_array.push_back(Value::fromDouble(p));
+                all_numbers = false;
+            }
+            new_array.push_back(std::move(r));
+        }
+        if (all_numbers) {
+            s.push(Value::packed(std::move(packed)));
             return;
         }
-        Symbol sym = x.asSymbol();
-        auto iter = s.dict.find(sym);
-        if (iter == s.dict.end()) {
+    } else {
+        for (const Value &v : arr.array_elems()) {
+            s.push(v);
+            s.exec_value(action);
+            if (s.unwinding)
+                return;
+            new_array.push_back(s.pop());
+        }
+    }
+    s.push(Value::from_vector(std::move(new_array)));
+}
+
+// Runs action on a stack of its own for each element, on the workers, and
+// pushes the results in order. What the action leaves on top is the
+// result, or nil if it leaves nothing.
+static void parallel_map(Interpreter &s, Value &action, const Value &arr, const double *in, std::size_t n) {
+    std::vector<Value> results(n, Value::nil());
+    Worker_pool::Task task = [&s, &action, &results, in](std::size_t worker, std::size_t begin, std::size_t end) {
+        Interpreter &w = s.helper(worker);
+        for (std::size_t i = begin; i < end; ++i) {
+            w.push(Value::fromDouble(in[i]));
+            w.exec_value(action);
+            if (!w.stack->empty())
+                results[i] = std::move(w.stack->back());
+            w.stack->clear();
+        }
+    };
+    Worker_pool &pool = s.workers();
+    // Several chunks per worker even out blocks whose cost varies.
+    std::size_t chunk = std::max<std::size_t>(PMAP_MIN_CHUNK, n / (pool.size() * 8));
+    if (n <= chunk)
+        task(0, 0, n);
+    else
+        pool.run(n, chunk, task);
+
+    bool all_numbers = true;
+    for (const Value &r : results)
+        all_numbers = all_numbers && r.tag() == VALUE_NUMBER;
+    if (all_numbers && arr.tag() == VALUE_PACKED) {
+        std::vector<double> packed(n);
+        for (std::size_t i = 0; i < n; ++i)
+            packed[i] = results[i].asDouble();
+        s.push(Value::packed(std::move(packed)));
+    } else {
+        s.push(Value::from_vector(Value::Elems(results.begin(), results.end())));
+    }
+}
+
+static const Built_in built_in_table[] = {
+    {"!", 2, {ARG_SYMBOL, ARG_ANY}, [](Interpreter &s, Value *args) {
+        s.dict.set(args[0].asSymbol(), std::move(args[1]));
+        s.drop(2);
+    }},
+    {"@", 1, {ARG_SYMBOL}, [](Interpreter &s, Value *args) {
+        Symbol sym = args[0].asSymbol();
+        const Value *v = s.dict.find(sym);
+        if (v == nullptr) {
             std::cerr << "Unknown word: " << s.symtab.symbol_string(sym) << std::endl;
+            s.drop(1);
             return;
         }
-        s.push(iter->second);
-    });
-    s.add_built_in("a{}", 0, [](Interpreter &s) {
+        args[0] = *v;
+    }},
+    {"a{}", 0, {}, [](Interpreter &s, Value *) {
         s.push(Value::array());
-    });
-    s.add_built_in("o{}", 0, [](Interpreter &s) {
+    }},
+    {"o{}", 0, {}, [](Interpreter &s, Value *) {
         s.push(Value::object());
-    });
-    s.add_built_in("size", 1, [](Interpreter &s) {
-        Value x = s.pop();
-        if (x.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in size\n";
-            return;
-        }
-        s.push(Value::fromDouble(x.array_elems().size()));
-    });
-    s.add_built_in(",", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value arr = s.pop();
-        if (arr.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in push\n";
-            return;
-        }
-        std::vector<Value> new_arr = arr.array_elems();
-        new_arr.push_back(x);
-        s.push(Value::from_vector(std::move(new_arr)));
-    });
-    s.add_built_in("pop", 1, [](Interpreter &s) {
-        Value x = s.pop();
-        if (x.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in pop\n";
-            return;
-        }
-        if (x.array_elems().empty()) {
+    }},
+    {"size", 1, {ARG_ANY_ARRAY}, [](Interpreter &, Value *args) {
+        if (args[0].tag() == VALUE_PACKED)
+            args[0] = Value::fromDouble(args[0].packed_elems().size());
+        else
+            args[0] = Value::fromDouble(args[0].array_elems().size());
+    }},
+    {",", 2, {ARG_ANY_ARRAY, ARG_ANY}, [](Interpreter &s, Value *args) {
+        if (args[0].tag() == VALUE_PACKED && args[1].tag() == VALUE_NUMBER) {
+            args[0].unshare();
+            args[0].packed_elems().push_back(args[1].asDouble());
+            s.drop(1);
+            return;
+        }
+        if (args[0].tag() == VALUE_PACKED)
+            args[0] = unpacked(args[0]);
+        args[0].unshare();
+        args[0].array_elems().push_back(std::move(args[1]));
+        s.drop(1);
+    }},
+    {"pop", 1, {ARG_ANY_ARRAY}, [](Interpreter &s, Value *args) {
+        bool packed = args[0].tag() == VALUE_PACKED;
+        if (packed ? args[0].packed_elems().empty() : args[0].array_elems().empty()) {
             std::cerr << "can't pop an empty array\n";
+            s.drop(1);
             return;
         }
-        std::vector<Value> elems = x.array_elems();
-        Value e = elems[elems.size() - 1];
-        elems.pop_back();
-        s.push(e);
-        s.push(Value::from_vector(std::move(elems)));
-    });
-    s.add_built_in("@i", 2, [](Interpreter &s) {
-        Value i = s.pop();
-        Value arr = s.pop();
-        if (arr.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in @i\n";
-            return;
-        }
-        if (i.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number in @i\n";
-            return;
-        }
-        double index = i.asDouble();
-        if (index < 0) {
-            std::cerr << "index out of range\n";
-            return;
-        }
-        std::vector<Value>::size_type index_i = index;
-        std::vector<Value> &elems = arr.array_elems();
-        if (index_i >= elems.size()) {
-            std::cerr << "index out of range\n";
-            return;
-        }
-        s.push(elems[index_i]);
-    });
-    s.add_built_in("!i", 3, [](Interpreter &s) {
-        Value v = s.pop();
-        Value i = s.pop();
-        Value arr = s.pop();
-        if (i.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number in !i\n";
-            return;
-        }
-        if (arr.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in !i\n";
-            return;
-        }
-        double index = i.asDouble();
-        if (index < 0) {
-            std::cerr << "index out of range in !i\n";
-            return;
-        }
-        std::vector<Value>::size_type index_i = index;
-        std::vector<Value> elems = arr.array_elems();
-        if (index_i >= elems.size()) {
-            std::cerr << "index out of range in !i\n";
-            return;
-        }
-        elems[index_i] = v;
-        s.push(Value::from_vector(elems));
-    });
-    s.add_built_in("save", 0, [](Interpreter &s) {
-        Value v = Value::array();
-        v.array_elems() = *s.stack;
+        args[0].unshare();
+        Value e = Value::nil();
+        if (packed) {
+            e = Value::fromDouble(args[0].packed_elems().back());
+            args[0].packed_elems().pop_back();
+        } else {
+            e = args[0].array_elems().back();
+            args[0].array_elems().pop_back();
+        }
+        Value arr = std::move(args[0]);
+        args[0] = std::move(e);
+        s.push(std::move(arr));
+    }},
+    {"@i", 2, {ARG_ANY_ARRAY, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        std::size_t index;
+        if (args[0].tag() == VALUE_PACKED) {
+            const std::vector<double> &elems = args[0].packed_elems();
+            if (!index_in(args[1], elems.size(), index, "@i")) {
+                s.drop(2);
+                return;
+            }
+            s.replace_top(2, Value::fromDouble(elems[index]));
+            return;
+        }
+        const Value::Elems &elems = args[0].array_elems();
+        if (!index_in(args[1], elems.size(), index, "@i")) {
+            s.drop(2);
+            return;
+        }
+        s.replace_top(2, elems[index]);
+    }},
+    {"!i", 3, {ARG_ANY_ARRAY, ARG_NUMBER, ARG_ANY}, [](Interpreter &s, Value *args) {
+        bool packed = args[0].tag() == VALUE_PACKED;
+        std::size_t size = packed ? args[0].packed_elems().size() : args[0].array_elems().size();
+        std::size_t index;
+        if (!index_in(args[1], size, index, "!i")) {
+            s.drop(3);
+            return;
+        }
+        if (packed && args[2].tag() == VALUE_NUMBER) {
+            args[0].unshare();
+            args[0].packed_elems()[index] = args[2].asDouble();
+            s.drop(2);
+            return;
+        }
+        if (packed)
+            args[0] = unpacked(args[0]);
+        args[0].unshare();
+        args[0].array_elems().set(index, std::move(args[2]));
+        s.drop(2);
+    }},
+    {"pack", 1, {ARG_ARRAY}, [](Interpreter &s, Value *args) {
+        const Value::Elems &elems = args[0].array_elems();
+        std::vector<double> packed;
+        packed.reserve(elems.size());
+        for (const Value &e : elems) {
+            if (e.tag() != VALUE_NUMBER) {
+                std::cerr << "array element is not a number in pack\n";
+                s.drop(1);
+                return;
+            }
+            packed.push_back(e.asDouble());
+        }
+        args[0] = Value::packed(std::move(packed));
+    }},
+    {"unpack", 1, {ARG_PACKED}, [](Interpreter &, Value *args) {
+        args[0] = unpacked(args[0]);
+    }},
+    {"range", 1, {ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        double n = args[0].asDouble();
+        if (!(n >= 0)) {
+            std::cerr << "size is negative in range\n";
+            s.drop(1);
+            return;
+        }
+        std::vector<double> elems(static_cast<std::size_t>(n));
+        for (std::size_t i = 0; i < elems.size(); ++i)
+            elems[i] = static_cast<double>(i);
+        args[0] = Value::packed(std::move(elems));
+    }},
+    {"sum", 1, {ARG_PACKED}, [](Interpreter &, Value *args) {
+        const std::vector<double> &elems = args[0].packed_elems();
+        args[0] = Value::fromDouble(simd_sum(elems.data(), elems.size()));
+    }},
+    {"min", 1, {ARG_PACKED}, [](Interpreter &s, Value *args) {
+        const std::vector<double> &elems = args[0].packed_elems();
+        if (elems.empty()) {
+            std::cerr << "packed array is empty in min\n";
+            s.drop(1);
+            return;
+        }
+        args[0] = Value::fromDouble(simd_min(elems.data(), elems.size()));
+    }},
+    {"max", 1, {ARG_PACKED}, [](Interpreter &s, Value *args) {
+        const std::vector<double> &elems = args[0].packed_elems();
+        if (elems.empty()) {
+            std::cerr << "packed array is empty in max\n";
+            s.drop(1);
+            return;
+        }
+        args[0] = Value::fromDouble(simd_max(elems.data(), elems.size()));
+    }},
+    {"dot", 2, {ARG_PACKED, ARG_PACKED}, [](Interpreter &s, Value *args) {
+        const std::vector<double> &x = args[0].packed_elems();
+        const std::vector<double> &y = args[1].packed_elems();
+        if (x.size() != y.size()) {
+            std::cerr << "packed arrays differ in size in dot\n";
+            s.drop(2);
+            return;
+        }
+        s.replace_top(2, Value::fromDouble(simd_dot(x.data(), y.data(), x.size())));
+    }},
+    {"save", 0, {}, [](Interpreter &s, Value *) {
+        Value v = Value::from_vector(Value::Elems(s.stack->begin(), s.stack->end()));
         s.push(v);
-    });
-    s.add_built_in("restore", 1, [](Interpreter &s) {
-        Value v = s.pop();
-        if (v.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not array in restore\n";
-            return;
-        }
-        *s.stack = v.array_elems();
-    });
-    s.add_built_in("@f", 2, [](Interpreter &s) {
-        Value key = s.pop();
-        Value obj = s.pop();
-        if (obj.tag() != VALUE_OBJECT) {
-            std::cerr << "value is not an object in @f\n";
-            return;
-        }
-        Value::Field_map &fields = obj.obj_fields();
-        auto it = fields.find(key);
-        if (it == fields.end()) {
+    }},
+    {"restore", 1, {ARG_ARRAY}, [](Interpreter &s, Value *args) {
+        Value v = std::move(args[0]);
+        const Value::Elems &elems = v.array_elems();
+        s.stack->assign(elems.begin(), elems.end());
+    }},
+    {"@f", 2, {ARG_OBJECT, ARG_ANY}, [](Interpreter &s, Value *args) {
+        const Value *field = args[0].field(args[1]);
+        if (field == nullptr) {
             std::cerr << "invalid key in @f\n";
-            return;
-        }
-        s.push(it->second);
-    });
-    s.add_built_in("!f", 3, [](Interpreter &s) {
-        Value val = s.pop();
-        Value key = s.pop();
-        Value obj = s.pop();
-        if (obj.tag() != VALUE_OBJECT) {
-            std::cerr << "value is not an object in !f\n";
-            return;
-        }
-        Value::Field_map map = obj.obj_fields();
-        map.emplace(std::pair(key, val));
-        s.push(Value::from_map(map));
-    });
-    s.add_built_in("delete", 2, [](Interpreter &s) {
-        Value key = s.pop();
-        Value obj = s.pop();
-        if (obj.tag() != VALUE_OBJECT) {
-            std::cerr << "value is not an object in !f\n";
-            return;
-        }
-        Value::Field_map &fields = obj.obj_fields();
-        auto it = fields.find(key);
-        if (it == fields.end()) {
-            std::cerr << "invalid key in @f\n";
-            return;
-        }
-        Value::Field_map new_fields = fields;
-        new_fields.erase(new_fields.find(key));
-        s.push(it->second);
-        s.push(Value::from_map(new_fields));
-    });
-    s.add_built_in("dup", 1, [](Interpreter &s) {
-        s.push(s.stack->operator[](s.stack->size() - 1));
-    });
-    s.add_built_in("drop", 1, [](Interpreter &s) {
-        s.pop();
-    });
-    s.add_built_in("swap", 2, [](Interpreter &s) {
-        Value x = s.stack->operator[](s.stack->size() - 1);
-        s.stack->operator[](s.stack->size() - 1) = s.stack->operator[](s.stack->size() - 2);
-        s.stack->operator[](s.stack->size() - 2) = std::move(x);
-    });
-    s.add_built_in("exec", 1, [](Interpreter &s) {
-        Value v = s.pop();
-        s.exec_value(v);
-    });
-    s.add_built_in("+", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(Value::fromDouble(x.asDouble() + y.asDouble()));
-    });
-    s.add_built_in("-", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(Value::fromDouble(x.asDouble() - y.asDouble()));
-    });
-    s.add_built_in("*", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(Value::fromDouble(x.asDouble() * y.asDouble()));
-    });
-    s.add_built_in("/", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        } else if (x.asDouble() == 0.0) {
+            s.drop(2);
+            return;
+        }
+        s.replace_top(2, *field);
+    }},
+    {"!f", 3, {ARG_OBJECT, ARG_ANY, ARG_ANY}, [](Interpreter &s, Value *args) {
+        args[0].unshare();
+        args[0].set_field(std::move(args[1]), std::move(args[2]));
+        s.drop(2);
+    }},
+    {"delete", 2, {ARG_OBJECT, ARG_ANY}, [](Interpreter &s, Value *args) {
+        const Value *field = args[0].field(args[1]);
+        if (field == nullptr) {
+            std::cerr << "invalid key in delete\n";
+            s.drop(2);
+            return;
+        }
+        Value v = *field;
+        args[0].unshare();
+        args[0].erase_field(args[1]);
+        args[1] = std::move(args[0]);
+        args[0] = std::move(v);
+    }},
+    {"dup", 1, {ARG_ANY}, [](Interpreter &s, Value *args) {
+        s.push(args[0]);
+    }},
+    {"drop", 1, {ARG_ANY}, [](Interpreter &s, Value *) {
+        s.drop(1);
+    }},
+    {"swap", 2, {ARG_ANY, ARG_ANY}, [](Interpreter &, Value *args) {
+        std::swap(args[0], args[1]);
+    }},
+    {"exec", 1, {ARG_ANY}, [](Interpreter &s, Value *args) {
+        Value v = std::move(args[0]);
+        s.drop(1);
+        s.exec_after(std::move(v));
+    }},
+    // The top operand comes first in - and /.
+    {"+", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, Value::fromDouble(args[1].asDouble() + args[0].asDouble()));
+        else
+            packed_binary(s, args, SIMD_ADD, true, "+");
+    }},
+    {"-", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, Value::fromDouble(args[1].asDouble() - args[0].asDouble()));
+        else
+            packed_binary(s, args, SIMD_SUB, true, "-");
+    }},
+    {"*", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, Value::fromDouble(args[1].asDouble() * args[0].asDouble()));
+        else
+            packed_binary(s, args, SIMD_MUL, true, "*");
+    }},
+    // Packed division follows IEEE 754 rather than reporting zeros.
+    {"/", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (!numbers(args)) {
+            packed_binary(s, args, SIMD_DIV, true, "/");
+            return;
+        }
+        if (args[1].asDouble() == 0.0) {
             std::cerr << "division by zero\n";
-            return;
-        }
-        s.push(Value::fromDouble(x.asDouble() / y.asDouble()));
-    });
-    s.add_built_in("<", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(y.asDouble() < x.asDouble() ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in(">", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(y.asDouble() > x.asDouble() ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in("<=", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(y.asDouble() <= x.asDouble() ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in(">=", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        if (x.tag() != VALUE_NUMBER || y.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number\n";
-            return;
-        }
-        s.push(y.asDouble() >= x.asDouble() ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in("=", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        s.push(x == y ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in("/=", 2, [](Interpreter &s) {
-        Value x = s.pop();
-        Value y = s.pop();
-        s.push(x != y ? Value::fromDouble(1) : Value::nil());
-    });
-    s.add_built_in("if", 3, [](Interpreter &s) {
-        Value boolean = s.pop();
-        Value thenb = s.pop();
-        Value elseb = s.pop();
-        s.exec_value(boolean.tag() == VALUE_NIL ? elseb : thenb);
-    });
-    s.add_built_in(".s", 0, [](Interpreter &s) {
+            s.drop(2);
+            return;
+        }
+        s.replace_top(2, Value::fromDouble(args[1].asDouble() / args[0].asDouble()));
+    }},
+    // On packed arrays these give 1 or 0 for each element.
+    {"<", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, truth(args[0].asDouble() < args[1].asDouble()));
+        else
+            packed_binary(s, args, SIMD_LT, false, "<");
+    }},
+    {">", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, truth(args[0].asDouble() > args[1].asDouble()));
+        else
+            packed_binary(s, args, SIMD_GT, false, ">");
+    }},
+    {"<=", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, truth(args[0].asDouble() <= args[1].asDouble()));
+        else
+            packed_binary(s, args, SIMD_LE, false, "<=");
+    }},
+    {">=", 2, {ARG_NUMERIC, ARG_NUMERIC}, [](Interpreter &s, Value *args) {
+        if (numbers(args))
+            s.replace_top(2, truth(args[0].asDouble() >= args[1].asDouble()));
+        else
+            packed_binary(s, args, SIMD_GE, false, ">=");
+    }},
+    {"=", 2, {ARG_ANY, ARG_ANY}, [](Interpreter &s, Value *args) {
+        s.replace_top(2, truth(args[0] == args[1]));
+    }},
+    {"/=", 2, {ARG_ANY, ARG_ANY}, [](Interpreter &s, Value *args) {
+        s.replace_top(2, truth(args[0] != args[1]));
+    }},
+    {"if", 3, {ARG_ANY, ARG_ANY, ARG_ANY}, [](Interpreter &s, Value *args) {
+        Value branch = std::move(args[2].tag() == VALUE_NIL ? args[0] : args[1]);
+        s.drop(3);
+        s.exec_after(std::move(branch));
+    }},
+    {".s", 0, {}, [](Interpreter &s, Value *) {
         if (s.stack->empty()) {
             std::cout << "[]\n";
         } else {
@@ -361,90 +582,195 @@ void load_built_ins(Interpreter& s) {
             }
             std::cout << "]\n";
         }
-    });
-    s.add_built_in("times", 0, [](Interpreter &s) {
-        Value k = s.pop();
-        Value action = s.pop();
-        if (k.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number in times\n";
-            return;
-        }
-        double count = k.asDouble();
-        for (double i = 0; i < count; ++i) {
+    }},
+    {"see", 1, {ARG_BLOCK}, [](Interpreter &s, Value *args) {
+        Value block = std::move(args[0]);
+        s.drop(1);
+        print_ops(s, block.asBlock()->ops);
+    }},
+    {"max-depth", 1, {ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        double depth = args[0].asDouble();
+        if (!(depth >= 1 && depth <= 1e9))
+            std::cerr << "depth is out of range in max-depth\n";
+        else
+            s.max_depth = static_cast<std::size_t>(depth);
+        s.drop(1);
+    }},
+    {"defer-frees", 1, {ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        double min = args[0].asDouble();
+        if (!(min >= 0 && min <= 1e15))
+            std::cerr << "size is out of range in defer-frees\n";
+        else
+            set_deferred_free_min(static_cast<std::size_t>(min));
+        s.drop(1);
+    }},
+    {".stats", 0, {}, [](Interpreter &s, Value *) {
+        print_histogram("timer lateness", s.timer_lateness);
+        print_histogram("queue delay", s.queue_delay);
+        print_histogram("callback lateness", s.callback_lateness);
+        print_histogram("callback run", s.callback_run);
+        print_histogram("wakeup", s.wakeup.latency());
+    }},
+    {"reset-stats", 0, {}, [](Interpreter &s, Value *) {
+        s.timer_lateness.reset();
+        s.queue_delay.reset();
+        s.callback_lateness.reset();
+        s.callback_run.reset();
+        s.wakeup.latency().reset();
+    }},
+    {".queues", 0, {}, [](Interpreter &s, Value *) {
+        print_queue("callbacks", s.callback_queue);
+        print_queue("input", s.input_queue);
+        print_queue("notes", s.notes);
+    }},
+    {".pool", 0, {}, [](Interpreter &, Value *) {
+        Pool_stats stats = pool_stats();
+        std::cout << "heap calls: chunks " << stats.chunks << " large " << stats.large << '\n';
+        for (const Pool_stats::Size_class &c : stats.classes) {
+            std::cout << c.size << " bytes: blocks " << c.blocks
+                << " in depot " << c.in_depot << '\n';
+        }
+    }},
+    {"times", 2, {ARG_ANY, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        Value action = std::move(args[0]);
+        double count = args[1].asDouble();
+        s.drop(2);
+        for (double i = 0; i < count && !s.unwinding; ++i) {
             s.push(Value::fromDouble(i));
             s.exec_value(action);
         }
-    });
-    s.add_built_in("iter", 2, [](Interpreter &s) {
-        Value arr = s.pop();
-        Value action = s.pop();
-        if (arr.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in iter\n";
-            return;
-        }
-        std::vector<Value> &elems = arr.array_elems();
-        for (Value &v :  elems) {
-            s.push(v);
-            s.exec_value(action);
-        }
-    });
-    s.add_built_in("map", 2, [](Interpreter &s) {
-        Value arr = s.pop();
-        Value action = s.pop();
-        if (arr.tag() != VALUE_ARRAY) {
-            std::cerr << "value is not an array in map\n";
+    }},
+    {"iter", 2, {ARG_ANY, ARG_ANY_ARRAY}, [](Interpreter &s, Value *args) {
+        Value action = std::move(args[0]);
+        Value arr = std::move(args[1]);
+        s.drop(2);
+        if (arr.tag() == VALUE_PACKED) {
+            for (double d : arr.packed_elems()) {
+                if (s.unwinding)
+                    return;
+                s.push(Value::fromDouble(d));
+                s.exec_value(action);
+            }
             return;
         }
-        std::vector<Value> &elems = arr.array_elems();
-        std::vector<Value> new_array;
-        for (Value &v :  elems) {
+        for (const Value &v : arr.array_elems()) {
+            if (s.unwinding)
+                return;
             s.push(v);
             s.exec_value(action);
-            new_array.push_back(s.pop());
-        }
-        s.push(Value::from_vector(new_array));
-    });
-    s.add_built_in("schedule", 2, [](Interpreter &s) {
-        Value time = s.pop();
-        Value action = s.pop();
-
-        if (time.tag() != VALUE_NUMBER) {
-            std::cerr << "value is not a number in schedule\n";
-            return;
-        }
-        if (action.tag() != VALUE_SYMBOL) {
-            std::cerr << "value is not a symbol in schedule\n";
-            return;
-        }
-        s.scheduler.schedule_callback(nullptr, action.asSymbol(), time.asDouble());
-    });
-    std::string at("at");
-    std::string freq("freq");
-    s.add_built_in("beep", 1, [at, freq](Interpreter &s) {
-        Value args = s.pop();
-        if (args.tag() != VALUE_OBJECT) {
-            std::cerr << "value is not an object in beep\n";
-            return;
         }
-        const Value::Field_map &fields = args.obj_fields();
-        const auto at_it = fields.find(Value::fromSymbol(s.symtab.intern(at)));
-        const auto freq_it = fields.find(Value::fromSymbol(s.symtab.intern(freq)));
-        if (at_it == fields.cend()) {
+    }},
+    {"map", 2, {ARG_ANY, ARG_ANY_ARRAY}, [](Interpreter &s, Value *args) {
+        Value action = std::move(args[0]);
+        Value arr = std::move(args[1]);
+        s.drop(2);
+        map_values(s, action, arr);
+    }},
+    // map on the worker pool, for actions that are parallel_safe over
+    // numbers. Each element runs on a stack of its own, so the action sees
+    // nothing below it. Anything else runs as map does.
+    {"pmap", 2, {ARG_ANY, ARG_ANY_ARRAY}, [](Interpreter &s, Value *args) {
+        Value action = std::move(args[0]);
+        Value arr = std::move(args[1]);
+        s.drop(2);
+        if (!parallel_safe(action)) {
+            map_values(s, action, arr);
+            return;
+        }
+        if (arr.tag() == VALUE_PACKED) {
+            const std::vector<double> &elems = arr.packed_elems();
+            parallel_map(s, action, arr, elems.data(), elems.size());
+            return;
+        }
+        std::vector<double> elems;
+        for (const Value &v : arr.array_elems()) {
+            if (v.tag() != VALUE_NUMBER) {
+                map_values(s, action, arr);
+                return;
+            }
+            elems.push_back(v.asDouble());
+        }
+        parallel_map(s, action, arr, elems.data(), elems.size());
+    }},
+    {"schedule", 2, {ARG_SYMBOL, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        s.scheduler.schedule_callback(nullptr, args[0].asSymbol(), args[1].asDouble());
+        s.drop(2);
+    }},
+    {"clock", 2, {ARG_SYMBOL, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        if (args[1].asDouble() <= 0)
+            std::cerr << "tempo is not a positive number in clock\n";
+        else
+            s.scheduler.make_clock(args[0].asSymbol(), args[1].asDouble());
+        s.drop(2);
+    }},
+    {"tempo", 2, {ARG_SYMBOL, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        Symbol name = args[0].asSymbol();
+        if (args[1].asDouble() <= 0)
+            std::cerr << "tempo is not a positive number in tempo\n";
+        else if (!s.scheduler.set_tempo(name, args[1].asDouble()))
+            std::cerr << "Unknown clock: " << s.symtab.symbol_string(name) << std::endl;
+        s.drop(2);
+    }},
+    {"beat", 1, {ARG_SYMBOL}, [](Interpreter &s, Value *args) {
+        Symbol name = args[0].asSymbol();
+        double beat;
+        if (!s.scheduler.beat(name, beat)) {
+            std::cerr << "Unknown clock: " << s.symtab.symbol_string(name) << std::endl;
+            s.drop(1);
+            return;
+        }
+        args[0] = Value::fromDouble(beat);
+    }},
+    {"schedule-beat", 3, {ARG_SYMBOL, ARG_SYMBOL, ARG_NUMBER}, [](Interpreter &s, Value *args) {
+        Symbol c = args[1].asSymbol();
+        if (!s.scheduler.schedule_callback(&c, args[0].asSymbol(), args[2].asDouble()))
+            std::cerr << "Unknown clock: " << s.symtab.symbol_string(c) << std::endl;
+        s.drop(3);
+    }},
+    {"beep", 1, {ARG_OBJECT}, [](Interpreter &s, Value *args) {
+        const Value &note = args[0];
+        const Value *at_v = note.field(Value::fromSymbol(Symbol(SYMBOL_AT)));
+        const Value *freq_v = note.field(Value::fromSymbol(Symbol(SYMBOL_FREQ)));
+        const Value *dur_v = note.field(Value::fromSymbol(Symbol(SYMBOL_DUR)));
+        const Value *amp_v = note.field(Value::fromSymbol(Symbol(SYMBOL_AMP)));
+        if (at_v == nullptr) {
             std::cerr << "field at is missing in beep\n";
-            return;
-        }
-        if (at_it->second.tag() != VALUE_NUMBER) {
+        } else if (at_v->tag() != VALUE_NUMBER) {
             std::cerr << "field at is not a number in beep\n";
-            return;
-        }
-        if (freq_it == fields.cend()) {
+        } else if (freq_v == nullptr) {
             std::cerr << "field freq is missing in beep\n";
-            return;
-        }
-        if (freq_it->second.tag() != VALUE_NUMBER) {
+        } else if (freq_v->tag() != VALUE_NUMBER) {
             std::cerr << "field freq is not a number in beep\n";
-            return;
-        }
-    });
+        } else if ((dur_v != nullptr && dur_v->tag() != VALUE_NUMBER)
+                   || (amp_v != nullptr && amp_v->tag() != VALUE_NUMBER)) {
+            std::cerr << "field dur or amp is not a number in beep\n";
+        } else {
+            Note_event note;
+            note.at = s.logical_time + std::chrono::duration_cast<Clock::time_point::duration>(
+                std::chrono::duration<double>(at_v->asDouble()));
+            note.instr = 1;
+            note.dur = dur_v == nullptr ? 1 : dur_v->asDouble();
+            note.amp = amp_v == nullptr ? 1000 : amp_v->asDouble();
+            note.freq = freq_v->asDouble();
+            if (!s.notes.push(note))
+                std::cerr << "note queue is full in beep\n";
+        }
+        s.drop(1);
+    }},
+    {"save-image", 1, {ARG_SYMBOL}, [](Interpreter &s, Value *args) {
+        std::string path(s.symtab.symbol_string(args[0].asSymbol()));
+        s.drop(1);
+        save_image(s, path);
+    }},
+    {"load-image", 1, {ARG_SYMBOL}, [](Interpreter &s, Value *args) {
+        std::string path(s.symtab.symbol_string(args[0].asSymbol()));
+        s.drop(1);
+        load_image(s, path);
+    }},
+};
+
+void load_built_ins(Interpreter& s) {
+    for (const Built_in &b : built_in_table)
+        s.add_built_in(b);
     alias(s, ",", "push");
 }
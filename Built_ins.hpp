@@ -1,8 +1,38 @@
 #ifndef BUILT_INS_HPP_INCLUDED
 #define BUILT_INS_HPP_INCLUDED
 
+#include "Value.hpp"
+
 class Interpreter;
 
+// Operand types, as masks of VALUE_* tags.
+#define ARG_ANY 0xFFu
+#define ARG_NUMBER (1u << VALUE_NUMBER)
+#define ARG_SYMBOL (1u << VALUE_SYMBOL)
+#define ARG_OBJECT (1u << VALUE_OBJECT)
+#define ARG_ARRAY (1u << VALUE_ARRAY)
+#define ARG_BLOCK (1u << VALUE_DEFINED)
+#define ARG_PACKED (1u << VALUE_PACKED)
+#define ARG_NUMERIC (ARG_NUMBER | ARG_PACKED)
+#define ARG_ANY_ARRAY (ARG_ARRAY | ARG_PACKED)
+
+#define MAX_BUILT_IN_ARGS 3
+
+// A built-in is called with its operands still on the stack: args points
+// at the deepest of them, so args[args - 1] is the top. The dispatcher
+// has already checked their number and types. The built-in consumes them,
+// usually with Interpreter::drop or replace_top, and must take what it
+// needs out of args before anything else can push onto the stack.
+using Native_f = void (*)(Interpreter &s, Value *args);
+
+struct Built_in {
+    const char *name;
+    unsigned args;
+    // Accepted tags of each operand, deepest first.
+    unsigned types[MAX_BUILT_IN_ARGS];
+    Native_f func;
+};
+
 void load_built_ins(Interpreter &s);
 
 #endif
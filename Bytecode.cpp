@@ -0,0 +1,195 @@
+#include "Bytecode.hpp"
+#include "Built_ins.hpp"
+#include <cstring>
+
+// Blocks of at most this many ops are inlined into the blocks calling them.
+// Words are bound when a block is compiled, so a block can never call
+// itself and inlining always terminates.
+#define INLINE_MAX_OPS 8
+
+// From OP_ADD to OP_DIV to the matching OP_*_NUMBER.
+#define OP_NUMBER_OFFSET (OP_ADD_NUMBER - OP_ADD)
+
+Block_t::Block_t(Symbol *_name, std::vector<Instr> _code)
+    : refcount(0), name(_name), code(std::move(_code)), ops() {}
+
+static bool is_call(const Op &op, const char *name) {
+    return op.code == OP_CALL_BUILT_IN && std::strcmp(op.built_in->name, name) == 0;
+}
+
+static bool is_arith(unsigned code) {
+    return code >= OP_ADD && code <= OP_DIV;
+}
+
+static bool is_arith_number(unsigned code) {
+    return code >= OP_ADD_NUMBER && code <= OP_DIV_NUMBER;
+}
+
+static Op call(const Built_in *b) {
+    static const char *const arith_names[] = {"+", "-", "*", "/"};
+    Op op;
+    op.code = OP_CALL_BUILT_IN;
+    op.built_in = b;
+    op.value = nullptr;
+    for (unsigned i = 0; i < 4; ++i) {
+        if (std::strcmp(b->name, arith_names[i]) == 0)
+            op.code = OP_ADD + i;
+    }
+    return op;
+}
+
+// Appends op, then rewrites the end of ops for as long as a rule applies.
+// Blocks have no jumps, so any sequence of ops can be rewritten.
+static void append(std::vector<Op> &ops, const Op &op) {
+    ops.push_back(op);
+    for (;;) {
+        std::size_t n = ops.size();
+        if (n < 2)
+            return;
+        Op &last = ops[n - 1];
+        Op &prev = ops[n - 2];
+        bool number = prev.code == OP_PUSH_NUMBER;
+        if (number && is_arith(last.code) && arith_ok(last.code, prev.number)) {
+            // 2 +
+            prev.code = last.code + OP_NUMBER_OFFSET;
+            prev.built_in = last.built_in;
+            ops.pop_back();
+        } else if (number && is_arith_number(last.code)) {
+            // 1 2 + is 3
+            prev.number = arith(last.code - OP_NUMBER_OFFSET, prev.number, last.number);
+            ops.pop_back();
+        } else if (number && last.code == OP_DUP_MUL) {
+            prev.number *= prev.number;
+            ops.pop_back();
+        } else if (number && n >= 3 && ops[n - 3].code == OP_PUSH_NUMBER && last.code == OP_SWAP_SUB) {
+            ops[n - 3].number -= prev.number;
+            ops.resize(n - 2);
+        } else if (number && is_call(last, "dup")) {
+            last = prev;
+        } else if (number && n >= 3 && ops[n - 3].code == OP_PUSH_NUMBER && is_call(last, "swap")) {
+            std::swap(ops[n - 3].number, prev.number);
+            ops.pop_back();
+        } else if ((number || prev.code == OP_PUSH_VALUE) && is_call(last, "drop")) {
+            ops.resize(n - 2);
+        } else if (is_call(prev, "dup") && last.code == OP_MUL) {
+            prev.code = OP_DUP_MUL;
+            prev.first = prev.built_in;
+            prev.built_in = last.built_in;
+            ops.pop_back();
+        } else if (is_call(prev, "swap") && last.code == OP_SUB) {
+            prev.code = OP_SWAP_SUB;
+            prev.first = prev.built_in;
+            prev.built_in = last.built_in;
+            ops.pop_back();
+        } else {
+            return;
+        }
+    }
+}
+
+void compile(Block_t &block, const void *const *targets) {
+    std::vector<Op> &ops = block.ops;
+    ops.clear();
+    ops.reserve(block.code.size() + 1);
+    for (const Instr &instr : block.code) {
+        const Value &v = instr.value;
+        Op op;
+        op.built_in = nullptr;
+        switch (instr.exec ? v.tag() : VALUE_NIL) {
+        case VALUE_BUILT_IN:
+            op = call(v.asBuiltIn());
+            break;
+        case VALUE_DEFINED: {
+            const Block_t *callee = v.asBlock();
+            std::size_t size = callee->ops.size() - 1;
+            if (size <= INLINE_MAX_OPS) {
+                for (std::size_t i = 0; i < size; ++i)
+                    append(ops, callee->ops[i]);
+                continue;
+            }
+            op.code = OP_CALL_DEFINED;
+            op.block = callee;
+          } break;
+        default:
+            if (v.tag() == VALUE_NUMBER) {
+                op.code = OP_PUSH_NUMBER;
+                op.number = v.asDouble();
+            } else {
+                op.code = OP_PUSH_VALUE;
+                op.value = &v;
+            }
+            break;
+        }
+        append(ops, op);
+    }
+    Op ret;
+    ret.code = OP_RETURN;
+    ret.built_in = nullptr;
+    ret.value = nullptr;
+    ops.push_back(ret);
+    for (Op &op : ops)
+        op.target = targets == nullptr ? nullptr : targets[op.code];
+}
+
+static bool parallel_safe(const Built_in *b) {
+    static const char *const names[] = {
+        "dup", "drop", "swap", "+", "-", "*", "/",
+        "<", ">", "<=", ">=", "=", "/="
+    };
+    for (const char *name : names) {
+        if (std::strcmp(b->name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool parallel_safe(const Block_t &block) {
+    for (const Op &op : block.ops) {
+        switch (op.code) {
+        case OP_PUSH_VALUE:
+            // Even a safe block would be retained when pushed.
+            if (op.value->tag() >= VALUE_DEFINED)
+                return false;
+            break;
+        case OP_CALL_BUILT_IN:
+            if (!parallel_safe(op.built_in))
+                return false;
+            break;
+        case OP_CALL_DEFINED:
+            if (!parallel_safe(*op.block))
+                return false;
+            break;
+        case OP_DUP_MUL:
+        case OP_SWAP_SUB:
+            if (!parallel_safe(op.first) || !parallel_safe(op.built_in))
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+bool parallel_safe(const Value &v) {
+    switch (v.tag()) {
+    case VALUE_BUILT_IN:
+        return parallel_safe(v.asBuiltIn());
+    case VALUE_DEFINED:
+        return parallel_safe(*v.asBlock());
+    case VALUE_NIL:
+    case VALUE_NUMBER:
+    case VALUE_SYMBOL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *op_name(unsigned code) {
+    static const char *const names[OP_COUNT] = {
+        "push", "push", "call", "call", "return",
+        "add", "sub", "mul", "div",
+        "add-number", "sub-number", "mul-number", "div-number",
+        "dup-mul", "swap-sub"
+    };
+    return code < OP_COUNT ? names[code] : "?";
+}
@@ -0,0 +1,99 @@
+#ifndef BYTECODE_HPP_INCLUDED
+#define BYTECODE_HPP_INCLUDED
+
+#include <vector>
+#include "Pool.hpp"
+#include "Value.hpp"
+
+#if defined(__GNUC__)
+#define OTJ_DIRECT_THREADED 1
+#endif
+
+#define OP_PUSH_NUMBER 0
+#define OP_PUSH_VALUE 1
+#define OP_CALL_BUILT_IN 2
+#define OP_CALL_DEFINED 3
+#define OP_RETURN 4
+// Superinstructions. Each does the work of the built-ins it replaces when
+// its operands are numbers, and otherwise falls back to calling them, so
+// errors are reported exactly as before.
+#define OP_ADD 5
+#define OP_SUB 6
+#define OP_MUL 7
+#define OP_DIV 8
+// A literal followed by an arithmetic built-in.
+#define OP_ADD_NUMBER 9
+#define OP_SUB_NUMBER 10
+#define OP_MUL_NUMBER 11
+#define OP_DIV_NUMBER 12
+// dup * and swap -.
+#define OP_DUP_MUL 13
+#define OP_SWAP_SUB 14
+#define OP_COUNT 15
+
+struct Op {
+    // Address of the handler in Interpreter::run when direct threading is
+    // available, nullptr otherwise.
+    const void *target;
+    unsigned code;
+    // The built-in called, or the last of those a superinstruction
+    // replaces.
+    const Built_in *built_in;
+    union {
+        double number;
+        const Value *value;
+        const Block_t *block;
+        // The first of a pair of built-ins fused into one op.
+        const Built_in *first;
+    };
+};
+
+struct Block_t {
+    unsigned long refcount;
+    Symbol *name;
+    std::vector<Instr> code;
+    std::vector<Op> ops;
+
+    Block_t(Symbol *_name, std::vector<Instr> _code);
+
+    static void *operator new(std::size_t size) { return pool_alloc(size); }
+    static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
+};
+
+// Translates block.code into block.ops, folding constants, fusing common
+// sequences into superinstructions and inlining small blocks. Operands
+// point into block.code, or into the code of blocks it refers to, so the
+// source instructions must not be modified afterwards.
+void compile(Block_t &block, const void *const *targets);
+
+// Whether executing v can be left to a worker thread: it may only push
+// numbers and values that are not refcounted, call blocks that do the
+// same, and use built-ins that work on nothing but the stack. Anything
+// that could touch the dictionary, the scheduler or a shared cell is
+// refused, since refcounts are not atomic.
+bool parallel_safe(const Value &v);
+
+// The name of an OP_* code, for disassembly.
+const char *op_name(unsigned code);
+
+// What the arithmetic built-in behind OP_ADD to OP_DIV computes from its
+// operands, deepest first. The top operand comes first in - and /.
+inline double arith(unsigned code, double a, double b) {
+    switch (code) {
+    case OP_ADD:
+        return b + a;
+    case OP_SUB:
+        return b - a;
+    case OP_MUL:
+        return b * a;
+    default:
+        return b / a;
+    }
+}
+
+// Whether the built-in succeeds rather than reporting an error.
+inline bool arith_ok(unsigned code, double b) {
+    return code != OP_DIV || b != 0.0;
+}
+
+#endif
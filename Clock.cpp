@@ -1,4 +1,22 @@
 #include "Clock.hpp"
 
 Clock::Clock(double _tempo)
-    : tempo(_tempo) {}
+    : Clock(std::chrono::steady_clock::now(), _tempo) {}
+
+Clock::Clock(time_point _epoch, double _tempo)
+    : epoch(_epoch), epoch_beat(0), tempo(_tempo) {}
+
+double Clock::beat_at(time_point t) const {
+    return epoch_beat + std::chrono::duration<double>(t - epoch).count() * tempo / 60.0;
+}
+
+Clock::time_point Clock::time_at(double beat) const {
+    return epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>((beat - epoch_beat) * 60.0 / tempo));
+}
+
+void Clock::set_tempo(time_point now, double _tempo) {
+    epoch_beat = beat_at(now);
+    epoch = now;
+    tempo = _tempo;
+}
@@ -1,9 +1,24 @@
 #pragma once
 
+#include <chrono>
+
+// Converts between beats and time from an absolute anchor: beat b happens
+// at epoch + (b - epoch_beat) * 60 / tempo. Every conversion starts from
+// the anchor, so nothing accumulates over a long run; a tempo change moves
+// the anchor to the beat reached at that moment.
 class Clock {
 public:
+    using time_point = std::chrono::steady_clock::time_point;
+
     Clock(double tempo);
+    Clock(time_point epoch, double tempo);
+
+    double beat_at(time_point t) const;
+    time_point time_at(double beat) const;
+    void set_tempo(time_point now, double tempo);
 
 private:
+    time_point epoch;
+    double epoch_beat;
     double tempo;
 };
@@ -0,0 +1,32 @@
+#include "Dictionary.hpp"
+
+Dictionary::Dictionary(): slots(), count(0) {}
+
+Dictionary::Slot &Dictionary::slot(const Symbol &s) {
+    if (s.id >= slots.size())
+        slots.resize(s.id + 1, Slot{Value::nil(), false});
+    return slots[s.id];
+}
+
+void Dictionary::set(const Symbol &s, Value v) {
+    Slot &sl = slot(s);
+    if (!sl.bound) {
+        sl.bound = true;
+        ++count;
+    }
+    sl.value = std::move(v);
+}
+
+bool Dictionary::define(const Symbol &s, Value v) {
+    Slot &sl = slot(s);
+    if (sl.bound)
+        return false;
+    sl.value = std::move(v);
+    sl.bound = true;
+    ++count;
+    return true;
+}
+
+std::size_t Dictionary::size() const {
+    return count;
+}
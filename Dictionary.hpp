@@ -0,0 +1,56 @@
+#ifndef DICTIONARY_HPP_INCLUDED
+#define DICTIONARY_HPP_INCLUDED
+
+#include <cstddef>
+#include <vector>
+#include "Symbol.hpp"
+#include "Value.hpp"
+
+// Word bindings stored in a flat array indexed by Symbol::id. Symbol ids
+// are handed out densely by Symbol_table, so a lookup is a bounds check
+// and a load, with no hashing. Slots past the end or never set are
+// unbound.
+class Dictionary {
+public:
+    Dictionary();
+
+    // Returns nullptr if s is unbound.
+    Value *find(const Symbol &s);
+    const Value *find(const Symbol &s) const;
+    // Binds s to v, replacing any previous binding.
+    void set(const Symbol &s, Value v);
+    // Binds s to v only if s is unbound. Returns whether it did.
+    bool define(const Symbol &s, Value v);
+    // Number of bound symbols.
+    std::size_t size() const;
+
+    // Calls f(symbol, value) for every binding, in id order.
+    template <class F>
+    void for_each(F f) const {
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].bound)
+                f(Symbol(i), slots[i].value);
+        }
+    }
+
+private:
+    struct Slot {
+        Value value;
+        bool bound;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t count;
+
+    Slot &slot(const Symbol &s);
+};
+
+inline Value *Dictionary::find(const Symbol &s) {
+    return s.id < slots.size() && slots[s.id].bound ? &slots[s.id].value : nullptr;
+}
+
+inline const Value *Dictionary::find(const Symbol &s) const {
+    return s.id < slots.size() && slots[s.id].bound ? &slots[s.id].value : nullptr;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef EVENT_QUEUE_HPP_INCLUDED
+#define EVENT_QUEUE_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include "Wakeup.hpp"
+
+// What push does when the queue is full. QUEUE_BLOCK parks the producer
+// until a pop makes room or the queue is closed.
+#define QUEUE_BLOCK 0
+#define QUEUE_DROP_OLDEST 1
+#define QUEUE_REJECT 2
+
+// A bounded lock-free queue for any number of producers (D. Vyukov's
+// bounded MPMC queue). Each cell carries a sequence number telling
+// producers and consumers whose turn it is, so neither side ever waits on
+// the other except when the queue is full or empty.
+template <class T>
+class Event_queue {
+public:
+    Event_queue(std::size_t min_capacity, unsigned _policy)
+        : mask(round_capacity(min_capacity) - 1),
+          cells(new Cell[mask + 1]),
+          policy(_policy),
+          enqueue_pos(0), dequeue_pos(0),
+          pushed_count(0), dropped_count(0), rejected_count(0), high_water_mark(0),
+          blocked(0), closed(false), room() {
+        for (std::size_t i = 0; i <= mask; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~Event_queue() {
+        T x;
+        while (pop(x)) {}
+    }
+
+    Event_queue(const Event_queue &) = delete;
+    Event_queue &operator=(const Event_queue &) = delete;
+
+    // Returns false if x was rejected because the queue is full, or is
+    // closed and full.
+    bool push(T x) {
+        while (!try_push(x)) {
+            switch (policy) {
+            case QUEUE_REJECT:
+                rejected_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case QUEUE_DROP_OLDEST: {
+                T old;
+                if (pop(old))
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+              } break;
+            default:
+                if (closed.load()) {
+                    rejected_count.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                wait_for_room();
+                break;
+            }
+        }
+        pushed_count.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t size = enqueue_pos.load(std::memory_order_relaxed)
+            - dequeue_pos.load(std::memory_order_relaxed);
+        std::uint64_t high = high_water_mark.load(std::memory_order_relaxed);
+        while (size > high && size <= mask + 1
+               && !high_water_mark.compare_exchange_weak(high, size, std::memory_order_relaxed)) {}
+        return true;
+    }
+
+    bool pop(T &out) {
+        Cell *cell;
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        T *elem = cell->elem();
+        out = std::move(*elem);
+        elem->~T();
+        cell->seq.store(pos + mask + 1, std::memory_order_release);
+        if (policy == QUEUE_BLOCK) {
+            // Pairs with the increment in wait_for_room.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (blocked.load(std::memory_order_relaxed) != 0)
+                room.notify();
+        }
+        return true;
+    }
+
+    template <class F>
+    bool consume_one(F f) {
+        T x;
+        if (!pop(x))
+            return false;
+        f(x);
+        return true;
+    }
+
+    template <class F>
+    std::size_t consume_all(F f) {
+        std::size_t n = 0;
+        T x;
+        while (pop(x)) {
+            f(x);
+            ++n;
+        }
+        return n;
+    }
+
+    // Makes producers that would wait for room give up instead, and wakes
+    // those already waiting. For when nothing is going to pop any more.
+    void close() {
+        closed.store(true);
+        room.notify_all();
+    }
+
+    std::size_t capacity() const {
+        return mask + 1;
+    }
+    std::uint64_t pushed() const {
+        return pushed_count.load(std::memory_order_relaxed);
+    }
+    std::uint64_t dropped() const {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+    std::uint64_t rejected() const {
+        return rejected_count.load(std::memory_order_relaxed);
+    }
+    std::uint64_t high_water() const {
+        return high_water_mark.load(std::memory_order_relaxed);
+    }
+    // Producers parked by QUEUE_BLOCK right now.
+    std::uint32_t blocked_producers() const {
+        return blocked.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *elem() {
+            return std::launder(reinterpret_cast<T *>(storage));
+        }
+    };
+
+    static std::size_t round_capacity(std::size_t n) {
+        std::size_t c = 2;
+        while (c < n)
+            c <<= 1;
+        return c;
+    }
+
+    bool try_push(T &x) {
+        Cell *cell;
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage) T(std::move(x));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool full() const {
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        std::size_t seq = cells[pos & mask].seq.load(std::memory_order_acquire);
+        return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos) < 0;
+    }
+
+    // Parks until a pop may have made room. The producer announces itself
+    // before its last look, so that a pop racing with it either sees it
+    // or leaves room for it to see.
+    void wait_for_room() {
+        std::uint32_t ticket = room.prepare();
+        blocked.fetch_add(1, std::memory_order_seq_cst);
+        if (full() && !closed.load())
+            room.wait(ticket);
+        blocked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    const unsigned policy;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos;
+    alignas(64) std::atomic<std::size_t> dequeue_pos;
+
+    alignas(64) std::atomic<std::uint64_t> pushed_count;
+    std::atomic<std::uint64_t> dropped_count;
+    std::atomic<std::uint64_t> rejected_count;
+    std::atomic<std::uint64_t> high_water_mark;
+
+    // Producers parked by QUEUE_BLOCK.
+    alignas(64) std::atomic<std::uint32_t> blocked;
+    std::atomic<bool> closed;
+    Wakeup room;
+};
+
+#endif
@@ -0,0 +1,433 @@
+#ifndef HAMT_HPP_INCLUDED
+#define HAMT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+
+#include "Pool.hpp"
+
+// A hash array mapped trie. Every node holds a 32-bit bitmap of inline
+// entries and one of sub-nodes, indexed by 5 bits of the key's hash per
+// level; keys whose whole hash collides end up in a flat collision node.
+// Copies share every node and updates copy only the path to the changed
+// entry, and only where that path is still shared with another map.
+template <class K, class V, class Hash = std::hash<K>, class Eq = std::equal_to<K>>
+class Hamt {
+public:
+    struct Entry {
+        K key;
+        V value;
+
+        Entry(K _key, V _value): key(std::move(_key)), value(std::move(_value)) {}
+    };
+
+    Hamt(): count(0), root(nullptr) {}
+
+    Hamt(const Hamt &other): count(other.count), root(other.root) {
+        if (root != nullptr)
+            ++root->refcount;
+    }
+
+    Hamt(Hamt &&other) noexcept: count(other.count), root(other.root) {
+        other.count = 0;
+        other.root = nullptr;
+    }
+
+    Hamt &operator=(Hamt other) noexcept {
+        std::swap(count, other.count);
+        std::swap(root, other.root);
+        return *this;
+    }
+
+    ~Hamt() {
+        if (root != nullptr)
+            release(root);
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const V *find(const K &key) const {
+        std::size_t h = Hash()(key);
+        const Node *node = root;
+        for (unsigned shift = 0; node != nullptr; shift += BITS) {
+            if (shift >= HASH_BITS) {
+                for (unsigned i = 0; i < node->ndata; ++i) {
+                    if (Eq()(node->data()[i].key, key))
+                        return &node->data()[i].value;
+                }
+                return nullptr;
+            }
+            std::uint32_t bit = bit_for(h, shift);
+            if (node->datamap & bit) {
+                const Entry &e = node->data()[index(node->datamap, bit)];
+                return Eq()(e.key, key) ? &e.value : nullptr;
+            }
+            if (!(node->nodemap & bit))
+                return nullptr;
+            node = node->children()[index(node->nodemap, bit)];
+        }
+        return nullptr;
+    }
+
+    // Inserts key or replaces its value.
+    void set(K key, V value) {
+        std::size_t h = Hash()(key);
+        bool added = false;
+        if (root == nullptr) {
+            root = alloc(0, 0, 1, 0);
+            new (root->data()) Entry(std::move(key), std::move(value));
+            root->datamap = bit_for(h, 0);
+            added = true;
+        } else {
+            root = insert(root, 0, h, Entry(std::move(key), std::move(value)), added);
+        }
+        if (added)
+            ++count;
+    }
+
+    // Removes key, returning whether it was present.
+    bool erase(const K &key) {
+        if (find(key) == nullptr)
+            return false;
+        root = remove(root, 0, Hash()(key), key);
+        --count;
+        return true;
+    }
+
+    // Entries held in nodes that no other map shares, counted until there
+    // are limit of them.
+    std::size_t owned(std::size_t limit) const {
+        std::size_t n = 0;
+        count_owned(root, limit, n);
+        return n;
+    }
+
+    // Takes the map apart for good, until about budget entries and shared
+    // nodes have been released, and returns whether it is empty. Nodes
+    // that another map still refers to are released whole, never copied.
+    // Until it returns true the map may only be passed back in; it must
+    // not even be destroyed.
+    bool release_some(std::size_t &budget) {
+        while (budget > 0 && root != nullptr) {
+            // Down the last children of nodes of our own to the first node
+            // that is shared or has no children left.
+            Node **link = &root;
+            for (;;) {
+                Node *node = *link;
+                Node **child = last_child(node);
+                if (node->refcount > 1) {
+                    --node->refcount;
+                    charge(budget, 1);
+                } else if (child == nullptr) {
+                    charge(budget, node->ndata == 0 ? 1 : node->ndata);
+                    free_node(node);
+                } else {
+                    link = child;
+                    continue;
+                }
+                *link = nullptr;
+                break;
+            }
+        }
+        if (root != nullptr)
+            return false;
+        count = 0;
+        return true;
+    }
+
+    template <class F>
+    void for_each(F f) const {
+        if (root != nullptr)
+            visit(root, f);
+    }
+
+private:
+    static constexpr unsigned BITS = 5;
+    static constexpr unsigned HASH_BITS = sizeof(std::size_t) * 8;
+
+    struct Node {
+        unsigned long refcount;
+        std::uint32_t datamap;
+        std::uint32_t nodemap;
+        unsigned ndata;
+        unsigned nnodes;
+
+        Entry *data() {
+            return std::launder(reinterpret_cast<Entry *>(
+                        reinterpret_cast<unsigned char *>(this) + data_offset()));
+        }
+        const Entry *data() const {
+            return std::launder(reinterpret_cast<const Entry *>(
+                        reinterpret_cast<const unsigned char *>(this) + data_offset()));
+        }
+        Node **children() {
+            return reinterpret_cast<Node **>(
+                    reinterpret_cast<unsigned char *>(this) + children_offset(ndata));
+        }
+        Node *const *children() const {
+            return reinterpret_cast<Node *const *>(
+                    reinterpret_cast<const unsigned char *>(this) + children_offset(ndata));
+        }
+    };
+
+    std::size_t count;
+    Node *root;
+
+    static constexpr std::size_t round_up(std::size_t n, std::size_t align) {
+        return (n + align - 1) / align * align;
+    }
+
+    static constexpr std::size_t data_offset() {
+        return round_up(sizeof(Node), alignof(Entry));
+    }
+
+    static constexpr std::size_t children_offset(unsigned ndata) {
+        return round_up(data_offset() + ndata * sizeof(Entry), alignof(Node *));
+    }
+
+    static constexpr std::size_t node_size(unsigned ndata, unsigned nnodes) {
+        return children_offset(ndata) + nnodes * sizeof(Node *);
+    }
+
+    static std::uint32_t bit_for(std::size_t h, unsigned shift) {
+        return std::uint32_t(1) << ((h >> shift) & 31);
+    }
+
+    static unsigned index(std::uint32_t bitmap, std::uint32_t bit) {
+        std::uint32_t below = bitmap & (bit - 1);
+#if defined(__GNUC__)
+        return __builtin_popcount(below);
+#else
+        unsigned n = 0;
+        for (; below != 0; below &= below - 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    // Allocates a node whose entries and children are still unconstructed.
+    static Node *alloc(std::uint32_t datamap, std::uint32_t nodemap, unsigned ndata, unsigned nnodes) {
+        void *p = pool_alloc(node_size(ndata, nnodes));
+        Node *node = new (p) Node;
+        node->refcount = 1;
+        node->datamap = datamap;
+        node->nodemap = nodemap;
+        node->ndata = ndata;
+        node->nnodes = nnodes;
+        return node;
+    }
+
+    static void count_owned(const Node *node, std::size_t limit, std::size_t &n) {
+        if (node == nullptr || node->refcount > 1 || n >= limit)
+            return;
+        n += node->ndata;
+        for (unsigned i = 0; i < node->nnodes; ++i)
+            count_owned(node->children()[i], limit, n);
+    }
+
+    // release_some clears the child pointers it has dealt with but leaves
+    // nnodes alone, which the size of the node is computed from.
+    static Node **last_child(Node *node) {
+        for (unsigned i = node->nnodes; i-- > 0;) {
+            if (node->children()[i] != nullptr)
+                return &node->children()[i];
+        }
+        return nullptr;
+    }
+
+    static void charge(std::size_t &budget, std::size_t cost) {
+        budget = cost >= budget ? 0 : budget - cost;
+    }
+
+    static void free_node(Node *node) {
+        for (unsigned i = 0; i < node->ndata; ++i)
+            node->data()[i].~Entry();
+        std::size_t size = node_size(node->ndata, node->nnodes);
+        node->~Node();
+        pool_free(node, size);
+    }
+
+    static void release(Node *node) {
+        if (node->refcount > 1) {
+            --node->refcount;
+            return;
+        }
+        for (unsigned i = 0; i < node->nnodes; ++i)
+            release(node->children()[i]);
+        free_node(node);
+    }
+
+    // Builds a node from src's entries and children, skipping the entry at
+    // skip_data and the child at skip_node (pass ~0u to keep all), and
+    // inserting extra_data / extra_node at the given positions. Entries are
+    // moved and children stolen when src is not shared; src's reference is
+    // consumed either way.
+    static Node *rebuild(Node *src, std::uint32_t datamap, std::uint32_t nodemap,
+                         unsigned skip_data, unsigned skip_node,
+                         unsigned data_at, Entry *extra_data,
+                         unsigned node_at, Node *extra_node) {
+        unsigned ndata = src->ndata - (skip_data != ~0u) + (extra_data != nullptr);
+        unsigned nnodes = src->nnodes - (skip_node != ~0u) + (extra_node != nullptr);
+        Node *node = alloc(datamap, nodemap, ndata, nnodes);
+        bool steal = src->refcount == 1;
+        Entry *out = node->data();
+        for (unsigned i = 0; i <= src->ndata; ++i) {
+            if (extra_data != nullptr && i == data_at)
+                new (out++) Entry(std::move(*extra_data));
+            if (i == src->ndata)
+                break;
+            if (i == skip_data)
+                continue;
+            if (steal)
+                new (out++) Entry(std::move(src->data()[i]));
+            else
+                new (out++) Entry(src->data()[i]);
+        }
+        Node **children = node->children();
+        for (unsigned i = 0; i <= src->nnodes; ++i) {
+            if (extra_node != nullptr && i == node_at)
+                *children++ = extra_node;
+            if (i == src->nnodes)
+                break;
+            if (i == skip_node)
+                continue;
+            Node *child = src->children()[i];
+            if (!steal)
+                ++child->refcount;
+            *children++ = child;
+        }
+        if (steal)
+            free_node(src);
+        else
+            --src->refcount;
+        return node;
+    }
+
+    // Takes over a reference to node and returns a node with the same
+    // contents that no other map can observe.
+    static Node *own(Node *node) {
+        if (node->refcount == 1)
+            return node;
+        return rebuild(node, node->datamap, node->nodemap, ~0u, ~0u, 0, nullptr, 0, nullptr);
+    }
+
+    static Node *merge(unsigned shift, Entry a, std::size_t ha, Entry b, std::size_t hb) {
+        if (shift >= HASH_BITS) {
+            Node *node = alloc(0, 0, 2, 0);
+            new (node->data()) Entry(std::move(a));
+            new (node->data() + 1) Entry(std::move(b));
+            return node;
+        }
+        std::uint32_t bit_a = bit_for(ha, shift);
+        std::uint32_t bit_b = bit_for(hb, shift);
+        if (bit_a == bit_b) {
+            Node *node = alloc(0, bit_a, 0, 1);
+            node->children()[0] = merge(shift + BITS, std::move(a), ha, std::move(b), hb);
+            return node;
+        }
+        Node *node = alloc(bit_a | bit_b, 0, 2, 0);
+        bool a_first = bit_a < bit_b;
+        new (node->data() + !a_first) Entry(std::move(a));
+        new (node->data() + a_first) Entry(std::move(b));
+        return node;
+    }
+
+    static Node *insert(Node *node, unsigned shift, std::size_t h, Entry e, bool &added) {
+        if (shift >= HASH_BITS) {
+            for (unsigned i = 0; i < node->ndata; ++i) {
+                if (Eq()(node->data()[i].key, e.key)) {
+                    node = own(node);
+                    node->data()[i].value = std::move(e.value);
+                    return node;
+                }
+            }
+            added = true;
+            return rebuild(node, 0, 0, ~0u, ~0u, node->ndata, &e, 0, nullptr);
+        }
+        std::uint32_t bit = bit_for(h, shift);
+        if (node->datamap & bit) {
+            unsigned i = index(node->datamap, bit);
+            if (Eq()(node->data()[i].key, e.key)) {
+                node = own(node);
+                node->data()[i].value = std::move(e.value);
+                return node;
+            }
+            added = true;
+            const Entry &old = node->data()[i];
+            Node *child = merge(shift + BITS, old, Hash()(old.key), std::move(e), h);
+            return rebuild(node, node->datamap & ~bit, node->nodemap | bit,
+                           i, ~0u, 0, nullptr, index(node->nodemap, bit), child);
+        }
+        if (node->nodemap & bit) {
+            node = own(node);
+            Node *&child = node->children()[index(node->nodemap, bit)];
+            child = insert(child, shift + BITS, h, std::move(e), added);
+            return node;
+        }
+        added = true;
+        return rebuild(node, node->datamap | bit, node->nodemap,
+                       ~0u, ~0u, index(node->datamap, bit), &e, 0, nullptr);
+    }
+
+    // Returns the node without key, or nullptr when nothing is left. The key
+    // must be present.
+    static Node *remove(Node *node, unsigned shift, std::size_t h, const K &key) {
+        if (shift >= HASH_BITS) {
+            if (node->ndata == 1) {
+                release(node);
+                return nullptr;
+            }
+            unsigned i = 0;
+            while (!Eq()(node->data()[i].key, key))
+                ++i;
+            return rebuild(node, 0, 0, i, ~0u, 0, nullptr, 0, nullptr);
+        }
+        std::uint32_t bit = bit_for(h, shift);
+        if (node->datamap & bit) {
+            if (node->ndata == 1 && node->nnodes == 0) {
+                release(node);
+                return nullptr;
+            }
+            return rebuild(node, node->datamap & ~bit, node->nodemap,
+                           index(node->datamap, bit), ~0u, 0, nullptr, 0, nullptr);
+        }
+        node = own(node);
+        unsigned ci = index(node->nodemap, bit);
+        Node *child = remove(node->children()[ci], shift + BITS, h, key);
+        node->children()[ci] = child;
+        if (child == nullptr) {
+            if (node->ndata == 0 && node->nnodes == 1) {
+                free_node(node);
+                return nullptr;
+            }
+            return rebuild(node, node->datamap, node->nodemap & ~bit, ~0u, ci, 0, nullptr, 0, nullptr);
+        }
+        if (child->ndata == 1 && child->nnodes == 0) {
+            // A single entry is left below: pull it up into this node.
+            Entry e = child->data()[0];
+            release(child);
+            return rebuild(node, node->datamap | bit, node->nodemap & ~bit,
+                           ~0u, ci, index(node->datamap, bit), &e, 0, nullptr);
+        }
+        return node;
+    }
+
+    template <class F>
+    static void visit(const Node *node, F &f) {
+        for (unsigned i = 0; i < node->ndata; ++i)
+            f(node->data()[i].key, node->data()[i].value);
+        for (unsigned i = 0; i < node->nnodes; ++i)
+            visit(node->children()[i], f);
+    }
+};
+
+#endif
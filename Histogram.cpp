@@ -0,0 +1,70 @@
+#include "Histogram.hpp"
+
+#include <cmath>
+
+Histogram::Histogram(): total(0), highest(0) {
+    for (std::atomic<std::uint64_t> &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+}
+
+unsigned Histogram::bucket_for(std::uint64_t value) {
+    if (value < SUB)
+        return static_cast<unsigned>(value);
+#if defined(__GNUC__)
+    unsigned msb = 63 - __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+    for (std::uint64_t v = value; v > 1; v >>= 1)
+        ++msb;
+#endif
+    unsigned shift = msb - SUB_BITS;
+    return (shift + 1) * SUB + static_cast<unsigned>((value >> shift) - SUB);
+}
+
+std::uint64_t Histogram::bucket_top(unsigned bucket) {
+    if (bucket < SUB)
+        return bucket;
+    unsigned shift = bucket / SUB - 1;
+    std::uint64_t lower = (bucket % SUB + SUB) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+void Histogram::record(std::uint64_t value) {
+    buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t high = highest.load(std::memory_order_relaxed);
+    while (value > high && !highest.compare_exchange_weak(high, value, std::memory_order_relaxed)) {}
+}
+
+void Histogram::reset() {
+    for (std::atomic<std::uint64_t> &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    highest.store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::count() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::max() const {
+    return highest.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::percentile(double p) const {
+    std::uint64_t n = count();
+    if (n == 0)
+        return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(p / 100.0 * n));
+    if (rank == 0)
+        rank = 1;
+    std::uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            std::uint64_t top = bucket_top(i);
+            return top < max() ? top : max();
+        }
+    }
+    return max();
+}
@@ -0,0 +1,41 @@
+#ifndef HISTOGRAM_HPP_INCLUDED
+#define HISTOGRAM_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+// A log-linear latency histogram in the style of HdrHistogram. Values
+// below SUB are counted exactly; above that every power of two is split
+// into SUB equal buckets, so any recorded value is known to within 1/SUB
+// of itself. Recording is a couple of relaxed atomic adds and never
+// allocates or locks, so any thread may record while another reads.
+class Histogram {
+public:
+    Histogram();
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    void record(std::uint64_t value);
+    void reset();
+
+    std::uint64_t count() const;
+    std::uint64_t max() const;
+    // The smallest bucket bound that at least p percent of the recorded
+    // values do not exceed; 0 when nothing was recorded.
+    std::uint64_t percentile(double p) const;
+
+private:
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr std::uint64_t SUB = std::uint64_t(1) << SUB_BITS;
+    static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    static unsigned bucket_for(std::uint64_t value);
+    static std::uint64_t bucket_top(unsigned bucket);
+
+    std::atomic<std::uint64_t> buckets[BUCKETS];
+    std::atomic<std::uint64_t> total;
+    std::atomic<std::uint64_t> highest;
+};
+
+#endif
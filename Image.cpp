@@ -0,0 +1,366 @@
+#include "Image.hpp"
+#include "Built_ins.hpp"
+#include "Bytecode.hpp"
+#include "Interpreter.hpp"
+#include "Mapped_file.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define IMAGE_MAGIC "OTJIMAGE"
+#define IMAGE_MAGIC_SIZE 8
+// Version 2 added packed arrays. Older images are still read.
+#define IMAGE_VERSION 2
+
+#define CELL_BLOCK 0
+#define CELL_ARRAY 1
+#define CELL_OBJECT 2
+#define CELL_PACKED 3
+
+static void put_u8(std::string &out, unsigned char x) {
+    out.push_back(static_cast<char>(x));
+}
+
+// Counts and ids are LEB128 varints.
+static void put_varint(std::string &out, std::uint64_t x) {
+    while (x >= 0x80) {
+        put_u8(out, static_cast<unsigned char>(x | 0x80));
+        x >>= 7;
+    }
+    put_u8(out, static_cast<unsigned char>(x));
+}
+
+static void put_double(std::string &out, double d) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &d, sizeof bits);
+    for (int i = 0; i < 8; ++i)
+        put_u8(out, static_cast<unsigned char>(bits >> (8 * i)));
+}
+
+class Image_writer {
+public:
+    Image_writer(Interpreter &_s): s(_s), cells(), cell_count(0), cell_data() {}
+
+    std::string write() {
+        std::string dict_data;
+        std::uint64_t entries = 0;
+        s.dict.for_each([this, &dict_data, &entries](Symbol name, const Value &v) {
+            // Built-ins still bound to their own name come back with
+            // load_built_ins.
+            if (v.tag() == VALUE_BUILT_IN && s.symtab.symbol_string(name) == v.asBuiltIn()->name)
+                return;
+            put_varint(dict_data, name.id);
+            value(dict_data, v);
+            ++entries;
+        });
+
+        std::string out(IMAGE_MAGIC);
+        put_varint(out, IMAGE_VERSION);
+        std::size_t symbols = s.symtab.size();
+        put_varint(out, symbols);
+        for (std::size_t i = 0; i < symbols; ++i) {
+            std::string_view name = s.symtab.symbol_string(Symbol(i));
+            put_varint(out, name.size());
+            out += name;
+        }
+        put_varint(out, cell_count);
+        out += cell_data;
+        put_varint(out, entries);
+        out += dict_data;
+        return out;
+    }
+
+private:
+    Interpreter &s;
+    std::unordered_map<const void *, std::uint64_t> cells;
+    std::uint64_t cell_count;
+    std::string cell_data;
+
+    void value(std::string &out, const Value &v) {
+        std::size_t tag = v.tag();
+        switch (tag) {
+        case VALUE_NUMBER:
+            put_u8(out, tag);
+            put_double(out, v.asDouble());
+            break;
+        case VALUE_SYMBOL:
+            put_u8(out, tag);
+            put_varint(out, v.asSymbol().id);
+            break;
+        case VALUE_BUILT_IN:
+            put_u8(out, tag);
+            put_varint(out, s.symtab.intern(v.asBuiltIn()->name).id);
+            break;
+        case VALUE_DEFINED:
+        case VALUE_ARRAY:
+        case VALUE_OBJECT:
+        case VALUE_PACKED: {
+            std::uint64_t index = cell(v);
+            put_u8(out, tag);
+            put_varint(out, index);
+          } break;
+        default:
+            put_u8(out, VALUE_NIL);
+            break;
+        }
+    }
+
+    // Writes v's cell after everything it refers to and returns its index.
+    std::uint64_t cell(const Value &v) {
+        const void *key = v.cell();
+        auto it = cells.find(key);
+        if (it != cells.end())
+            return it->second;
+
+        std::string body;
+        switch (v.tag()) {
+        case VALUE_DEFINED: {
+            const std::vector<Instr> &code = v.asBlock()->code;
+            put_u8(body, CELL_BLOCK);
+            put_varint(body, code.size());
+            for (const Instr &instr : code) {
+                put_u8(body, instr.exec);
+                value(body, instr.value);
+            }
+          } break;
+        case VALUE_ARRAY: {
+            const Value::Elems &elems = v.array_elems();
+            put_u8(body, CELL_ARRAY);
+            put_varint(body, elems.size());
+            for (const Value &e : elems)
+                value(body, e);
+          } break;
+        case VALUE_PACKED: {
+            const std::vector<double> &elems = v.packed_elems();
+            put_u8(body, CELL_PACKED);
+            put_varint(body, elems.size());
+            for (double d : elems)
+                put_double(body, d);
+          } break;
+        default: {
+            put_u8(body, CELL_OBJECT);
+            put_varint(body, v.field_count());
+            v.for_each_field([this, &body](const Value &k, const Value &x) {
+                value(body, k);
+                value(body, x);
+            });
+          } break;
+        }
+        cell_data += body;
+        cells.emplace(key, cell_count);
+        return cell_count++;
+    }
+};
+
+class Image_reader {
+public:
+    Image_reader(Interpreter &_s, std::string_view data)
+        : s(_s), p(data.data()), end(data.data() + data.size()),
+          error(nullptr), symbols(), cells() {}
+
+    bool read(std::vector<std::pair<Symbol, Value>> &entries) {
+        if (end - p < IMAGE_MAGIC_SIZE || std::memcmp(p, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) != 0)
+            return fail("not an image");
+        p += IMAGE_MAGIC_SIZE;
+        std::uint64_t version = varint();
+        if (version == 0 || version > IMAGE_VERSION)
+            return fail("unsupported image version");
+
+        std::uint64_t nsymbols = varint();
+        for (std::uint64_t i = 0; i < nsymbols && error == nullptr; ++i) {
+            std::uint64_t size = varint();
+            if (static_cast<std::uint64_t>(end - p) < size)
+                return fail("truncated image");
+            symbols.push_back(s.symtab.intern(std::string_view(p, size)));
+            p += size;
+        }
+
+        std::uint64_t ncells = varint();
+        for (std::uint64_t i = 0; i < ncells && error == nullptr; ++i)
+            cells.push_back(cell());
+
+        std::uint64_t nentries = varint();
+        for (std::uint64_t i = 0; i < nentries && error == nullptr; ++i) {
+            Symbol name = symbol();
+            Value v = value();
+            entries.emplace_back(name, std::move(v));
+        }
+        if (error == nullptr && p != end)
+            return fail("trailing data in image");
+        return error == nullptr;
+    }
+
+    const char *why() const {
+        return error;
+    }
+
+private:
+    Interpreter &s;
+    const char *p;
+    const char *end;
+    const char *error;
+    std::vector<Symbol> symbols;
+    std::vector<Value> cells;
+
+    bool fail(const char *message) {
+        if (error == nullptr)
+            error = message;
+        p = end;
+        return false;
+    }
+
+    unsigned char u8() {
+        if (p == end) {
+            fail("truncated image");
+            return 0;
+        }
+        return static_cast<unsigned char>(*p++);
+    }
+
+    std::uint64_t varint() {
+        std::uint64_t x = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            unsigned char b = u8();
+            x |= std::uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return x;
+        }
+        fail("bad number in image");
+        return 0;
+    }
+
+    double number() {
+        std::uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i)
+            bits |= std::uint64_t(u8()) << (8 * i);
+        double d;
+        std::memcpy(&d, &bits, sizeof d);
+        return d;
+    }
+
+    Symbol symbol() {
+        std::uint64_t id = varint();
+        if (id >= symbols.size()) {
+            fail("bad symbol in image");
+            return Symbol();
+        }
+        return symbols[id];
+    }
+
+    Value value() {
+        std::size_t tag = u8();
+        switch (tag) {
+        case VALUE_NIL:
+            return Value::nil();
+        case VALUE_NUMBER:
+            return Value::fromDouble(number());
+        case VALUE_SYMBOL:
+            return Value::fromSymbol(symbol());
+        case VALUE_BUILT_IN: {
+            Symbol name = symbol();
+            const Value *b = s.built_ins.find(name);
+            if (b == nullptr) {
+                if (error == nullptr)
+                    std::cerr << "Unknown built-in in image: " << s.symtab.symbol_string(name) << std::endl;
+                fail("image needs a missing built-in");
+                return Value::nil();
+            }
+            return *b;
+          }
+        case VALUE_DEFINED:
+        case VALUE_ARRAY:
+        case VALUE_OBJECT:
+        case VALUE_PACKED: {
+            std::uint64_t index = varint();
+            if (index >= cells.size() || cells[index].tag() != tag) {
+                fail("bad cell reference in image");
+                return Value::nil();
+            }
+            return cells[index];
+          }
+        default:
+            fail("bad value in image");
+            return Value::nil();
+        }
+    }
+
+    Value cell() {
+        unsigned char kind = u8();
+        std::uint64_t n = varint();
+        // Every element takes at least one byte, which bounds n before
+        // anything is reserved for it.
+        if (static_cast<std::uint64_t>(end - p) < n) {
+            fail("truncated image");
+            return Value::nil();
+        }
+        switch (kind) {
+        case CELL_BLOCK: {
+            std::vector<Instr> code;
+            code.reserve(n);
+            for (std::uint64_t i = 0; i < n && error == nullptr; ++i) {
+                bool exec = u8() != 0;
+                code.emplace_back(exec, value());
+            }
+            return s.make_block(std::move(code));
+          }
+        case CELL_ARRAY: {
+            Value::Elems elems;
+            for (std::uint64_t i = 0; i < n && error == nullptr; ++i)
+                elems.push_back(value());
+            return Value::from_vector(std::move(elems));
+          }
+        case CELL_OBJECT: {
+            Value obj = Value::object();
+            for (std::uint64_t i = 0; i < n && error == nullptr; ++i) {
+                Value k = value();
+                obj.set_field(std::move(k), value());
+            }
+            return obj;
+          }
+        case CELL_PACKED: {
+            if (static_cast<std::uint64_t>(end - p) / 8 < n) {
+                fail("truncated image");
+                return Value::nil();
+            }
+            std::vector<double> elems(n);
+            for (double &d : elems)
+                d = number();
+            return Value::packed(std::move(elems));
+          }
+        default:
+            fail("bad cell in image");
+            return Value::nil();
+        }
+    }
+};
+
+bool save_image(Interpreter &s, const std::string &path) {
+    std::string image = Image_writer(s).write();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.write(image.data(), image.size())) {
+        std::cerr << "Cannot write image " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_image(Interpreter &s, const std::string &path) {
+    Mapped_file file(path);
+    if (!file.ok()) {
+        std::cerr << "Cannot read image " << path << ": " << file.error() << std::endl;
+        return false;
+    }
+    std::vector<std::pair<Symbol, Value>> entries;
+    Image_reader reader(s, file.contents());
+    if (!reader.read(entries)) {
+        std::cerr << "Cannot load image " << path << ": " << reader.why() << std::endl;
+        return false;
+    }
+    for (auto &entry : entries)
+        s.dict.set(entry.first, std::move(entry.second));
+    return true;
+}
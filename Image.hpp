@@ -0,0 +1,18 @@
+#ifndef IMAGE_HPP_INCLUDED
+#define IMAGE_HPP_INCLUDED
+
+#include <string>
+
+class Interpreter;
+
+// An image holds the symbol table, the dictionary and every block, array
+// and object reachable from it. Cells are written children first, so a
+// loader can rebuild them in a single pass over the mapped file, and
+// shared cells stay shared. Built-ins are stored by name and relinked to
+// the running interpreter's own on load.
+bool save_image(Interpreter &s, const std::string &path);
+// Merges an image into s: its words replace any of the same name. The
+// dictionary is left alone if the image cannot be read.
+bool load_image(Interpreter &s, const std::string &path);
+
+#endif
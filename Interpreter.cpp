@@ -1,47 +1,141 @@
 #include "Interpreter.hpp"
+#include "Built_ins.hpp"
+#include "Bytecode.hpp"
+#include "Lexer.hpp"
+#include "Mapped_file.hpp"
+#include "Worker_pool.hpp"
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <thread>
 
-Interpreter::Interpreter()
-    : scheduler(std::bind(&Interpreter::execute_callback, this, std::placeholders::_1)),
-      symtab(), dict(), stack(), main_stack(), callback_stack(), callback_queue(100), input_queue(200), assembling() {
+#define DEFAULT_MAX_DEPTH 100000
+// Nested calls of exec_value, from built-ins such as times and map that
+// run code in a loop. Each takes a few hundred bytes of native stack, so
+// this stays well inside the usual 8 MB.
+#define MAX_NESTING 2000
+// Values the idle loop releases from deferred cells before it looks at
+// the queues again, a few tens of microseconds' worth.
+#define RECLAIM_SLICE 512
+
+// Handler addresses of Interpreter::run, published by run(nullptr).
+static const void *const *threaded_targets = nullptr;
+
+// Clamps to zero, for stages that can come out slightly negative.
+static std::uint64_t nanoseconds(Clock::time_point::duration d) {
+    std::int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    return ns < 0 ? 0 : ns;
+}
+
+// A slow callback must not hold up the scheduler thread and every timer
+// behind it, so a full callback queue drops its most overdue entry.
+Interpreter::Interpreter(): Interpreter(128, QUEUE_DROP_OLDEST, 256, QUEUE_BLOCK) {}
+
+Interpreter::Interpreter(std::size_t callback_capacity, unsigned callback_policy,
+                         std::size_t input_capacity, unsigned input_policy,
+                         std::size_t schedule_capacity)
+    : scheduler(std::bind(&Interpreter::execute_callback, this, std::placeholders::_1),
+                schedule_capacity),
+      symtab(), dict(), built_ins(), stack(), wakeup(),
+      callback_queue(callback_capacity, callback_policy),
+      input_queue(input_capacity, input_policy),
+      notes(1024, QUEUE_REJECT), logical_time(std::chrono::steady_clock::now()),
+      timer_lateness(), queue_delay(), callback_lateness(), callback_run(),
+      max_depth(DEFAULT_MAX_DEPTH), unwinding(false),
+      worker_count(std::max(1u, std::thread::hardware_concurrency())),
+      main_stack(), callback_stack(), assembling(),
+      frames(), pending(Value::nil()), has_pending(false), nesting(0),
+      helpers(), pool() {
           stack = &main_stack;
+          run(nullptr);
+          // Added before anything else is interned, so built-in names get
+          // the same ids in every interpreter.
+          load_built_ins(*this);
       }
 
+Interpreter::~Interpreter() = default;
+
+Worker_pool &Interpreter::workers() {
+    if (!pool) {
+        for (std::size_t i = 0; i < worker_count; ++i)
+            helpers.emplace_back(new Interpreter(1, QUEUE_REJECT, 1, QUEUE_REJECT, 0));
+        pool.reset(new Worker_pool(worker_count));
+    }
+    return *pool;
+}
+
+Interpreter &Interpreter::helper(std::size_t i) {
+    return *helpers[i];
+}
+
 void Interpreter::start(std::atomic_bool &run) {
     std::thread sched_thread = std::thread([this]() {
         scheduler.start();
     });
 
     while (run.load()) {
-        callback_queue.consume_all([this](Symbol &s) {
-            auto iter = dict.find(s);
-            if (iter == dict.end()) {
+        std::uint32_t ticket = wakeup.prepare();
+        std::size_t work = 0;
+        auto run_callback = [this](Due_callback &c) {
+            const Value *found = dict.find(c.func);
+            if (found == nullptr) {
                 return;
             }
+            // A copy: the callback may rebind words, which can move or
+            // replace the slot.
+            Value word = *found;
+            Clock::time_point started = std::chrono::steady_clock::now();
+            timer_lateness.record(nanoseconds(c.fired - c.deadline));
+            queue_delay.record(nanoseconds(started - c.fired));
+            callback_lateness.record(nanoseconds(started - c.deadline));
+
+            logical_time = c.deadline;
             stack = &callback_stack;
-            exec_value(iter->second);
+            exec_value(word);
             callback_stack.clear();
             stack = &main_stack;
+
+            callback_run.record(nanoseconds(std::chrono::steady_clock::now() - started));
+        };
+        // Callbacks still queued once run is cleared are left alone.
+        while (run.load() && callback_queue.consume_one(run_callback))
+            ++work;
+        work += input_queue.consume_one([this](std::string &line){
+            logical_time = std::chrono::steady_clock::now();
+            process_text(line);
         });
-        input_queue.consume_one([this](std::string &tok){
-            process_read(tok);
-        });
+        // Cells dropped by earlier work are taken apart only while nothing
+        // else is waiting, a slice at a time.
+        if (work == 0 && reclaim_deferred(RECLAIM_SLICE))
+            continue;
+        if (work == 0 && run.load())
+            wakeup.wait(ticket);
     }
+
+    // The scheduler thread and readers may be waiting for room in queues
+    // that nothing pops any more.
+    scheduler.stop();
+    callback_queue.close();
+    input_queue.close();
+    sched_thread.join();
+}
+
+void Interpreter::wake() {
+    wakeup.notify();
 }
 
-void Interpreter::execute_callback(Symbol s) {
-    callback_queue.push(s);
+void Interpreter::execute_callback(const Due_callback &c) {
+    if (callback_queue.push(c))
+        wakeup.notify();
 }
 
 void Interpreter::process_reference(bool exec, Symbol s) {
-    auto iter = dict.find(s);
-    if (iter == dict.end()) {
+    const Value *word = dict.find(s);
+    if (word == nullptr) {
         std::cerr << "Unknown word: " << symtab.symbol_string(s) << std::endl;
         return;
     }
-    process(exec, iter->second);
+    process(exec, *word);
 }
 
 void Interpreter::process(bool exec, Value v) {
@@ -55,86 +149,416 @@ void Interpreter::process(bool exec, Value v) {
     }
 }
 
-void Interpreter::read(const std::string &str) {
-    input_queue.push(str);
+bool Interpreter::read(const std::string &line) {
+    if (!input_queue.push(line))
+        return false;
+    wakeup.notify();
+    return true;
 }
 
-void Interpreter::process_read(const std::string &tok) {
-    if (tok.size() == 0)
-        return;
-    try {
-        double d = std::stod(tok);
-        process(false, Value::fromDouble(d));
-        return;
-    } catch (const std::invalid_argument &) {
-        if (tok.size() == 1) {
-            switch (tok[0]) {
-            case '[':
-                assembling.emplace_back();
-                return;
-            case ']':
-                if (assembling.empty()) {
-                    std::cerr << "[ with no matching ]\n";
-                    return;
-                } else {
-                    Value v = Value::func(nullptr,
-                                          std::move(assembling[assembling.size() - 1]));
-                    assembling.pop_back();
-                    process(false, std::move(v));
-                    return;
-                }
-            case '&':
-            case '$':
-                std::cerr << "Invalid word: " << tok << std::endl;
-                return;
-            default:
-                process_reference(true, symtab.intern(tok));
-                return;
-            }
+void Interpreter::eval(std::string_view src) {
+    logical_time = std::chrono::steady_clock::now();
+    process_text(src);
+}
+
+bool Interpreter::load(const std::string &path) {
+    Mapped_file file(path);
+    if (!file.ok()) {
+        std::cerr << "Cannot read " << path << ": " << file.error() << std::endl;
+        return false;
+    }
+    eval(file.contents());
+    if (!assembling.empty()) {
+        std::cerr << "Unterminated [ at end of " << path << std::endl;
+        assembling.clear();
+    }
+    return true;
+}
+
+void Interpreter::process_text(std::string_view src) {
+    Lexer lexer(src);
+    Token tok;
+    while (lexer.next(tok))
+        process_token(tok);
+}
+
+void Interpreter::process_token(const Token &tok) {
+    switch (tok.kind) {
+    case TOKEN_NUMBER:
+        process(false, Value::fromDouble(tok.number));
+        break;
+    case TOKEN_OPEN:
+        assembling.emplace_back();
+        break;
+    case TOKEN_CLOSE:
+        if (assembling.empty()) {
+            std::cerr << "[ with no matching ]\n";
         } else {
-            switch (tok[0]) {
-            case '$':
-                process(false, Value::fromSymbol(symtab.intern(tok.substr(1))));
-                break;
-            case '&':
-                process_reference(false, symtab.intern(tok.substr(1)));
-                break;
-            default:
-                process_reference(true, symtab.intern(tok));
-                break;
-            }
+            Value v = make_block(std::move(assembling[assembling.size() - 1]));
+            assembling.pop_back();
+            process(false, std::move(v));
         }
+        break;
+    case TOKEN_SYMBOL:
+        process(false, Value::fromSymbol(symtab.intern(tok.text)));
+        break;
+    case TOKEN_QUOTE:
+        process_reference(false, symtab.intern(tok.text));
+        break;
+    case TOKEN_WORD:
+        process_reference(true, symtab.intern(tok.text));
+        break;
+    default:
+        std::cerr << "Invalid word: " << tok.text << std::endl;
+        break;
     }
 }
 
 void Interpreter::exec_value(Value &v) {
+    if (nesting == 0)
+        unwinding = false;
+    else if (unwinding)
+        return;
+    if (nesting >= MAX_NESTING) {
+        overflow();
+        return;
+    }
+    ++nesting;
     switch (v.tag()) {
     case VALUE_BUILT_IN:
-        if (v.nativeFuncArgs() > stack->size()) {
-            std::cerr << "stack too small for "
-                << symtab.symbol_string(*(v.funcName()))
-                << std::endl;
+        call_built_in(*v.asBuiltIn());
+        while (has_pending && !unwinding) {
+            Value next = std::move(pending);
+            has_pending = false;
+            if (next.tag() == VALUE_BUILT_IN)
+                call_built_in(*next.asBuiltIn());
+            else if (next.tag() == VALUE_DEFINED)
+                run(next.asBlock()->ops.data());
+            else
+                push(std::move(next));
+        }
+        has_pending = false;
+        break;
+    case VALUE_DEFINED:
+        run(v.asBlock()->ops.data());
+        break;
+    default:
+        push(v);
+        break;
+    }
+    --nesting;
+}
+
+void Interpreter::exec_after(Value v) {
+    pending = std::move(v);
+    has_pending = true;
+}
+
+void Interpreter::overflow() {
+    if (!unwinding)
+        std::cerr << "return stack overflow\n";
+    unwinding = true;
+}
+
+inline bool Interpreter::enter(const Op *ret, Value block) {
+    if (frames.size() >= max_depth) {
+        overflow();
+        return false;
+    }
+    frames.push_back(Frame{ret, std::move(block)});
+    return true;
+}
+
+inline const Op *Interpreter::call_op(const Op *ip) {
+    const Op *target = ip->block->ops.data();
+    if (ip[1].code != OP_RETURN && !enter(ip + 1, Value::nil()))
+        return nullptr;
+    return target;
+}
+
+inline const Op *Interpreter::after_built_in(const Op *next) {
+    while (has_pending && !unwinding) {
+        Value v = std::move(pending);
+        has_pending = false;
+        switch (v.tag()) {
+        case VALUE_BUILT_IN:
+            call_built_in(*v.asBuiltIn());
+            break;
+        case VALUE_DEFINED: {
+            const Op *target = v.asBlock()->ops.data();
+            if (next->code == OP_RETURN)
+                frames.back().block = std::move(v);
+            else if (!enter(next, std::move(v)))
+                return nullptr;
+            return target;
+          }
+        default:
+            push(std::move(v));
+            break;
+        }
+    }
+    has_pending = false;
+    return unwinding ? nullptr : next;
+}
+
+Value Interpreter::make_block(std::vector<Instr> code) {
+    Value v = Value::func(nullptr, std::move(code));
+    compile(*v.asBlock(), threaded_targets);
+    return v;
+}
+
+static const char *type_name(unsigned types) {
+    switch (types) {
+    case ARG_NUMBER:
+        return "a number";
+    case ARG_SYMBOL:
+        return "a symbol";
+    case ARG_OBJECT:
+        return "an object";
+    case ARG_ARRAY:
+        return "an array";
+    case ARG_BLOCK:
+        return "a block";
+    case ARG_PACKED:
+        return "a packed array";
+    case ARG_NUMERIC:
+        return "a number or packed array";
+    case ARG_ANY_ARRAY:
+        return "an array";
+    default:
+        return "of the right type";
+    }
+}
+
+void Interpreter::call_built_in(const Built_in &b) {
+    std::size_t size = stack->size();
+    if (b.args > size) {
+        std::cerr << "stack too small for " << b.name << std::endl;
+        return;
+    }
+    Value *args = stack->data() + (size - b.args);
+    for (unsigned i = 0; i < b.args; ++i) {
+        if (!(b.types[i] & (1u << args[i].tag()))) {
+            std::cerr << "value is not " << type_name(b.types[i]) << " in " << b.name << std::endl;
+            drop(b.args);
             return;
         }
-        v.nativeFunc()(*this);
+    }
+    b.func(*this, args);
+}
+
+inline void Interpreter::arith_op(const Op *ip, unsigned code) {
+    std::size_t size = stack->size();
+    if (size >= 2) {
+        Value *args = stack->data() + (size - 2);
+        if (args[0].tag() == VALUE_NUMBER && args[1].tag() == VALUE_NUMBER
+            && arith_ok(code, args[1].asDouble())) {
+            args[0] = Value::fromDouble(arith(code, args[0].asDouble(), args[1].asDouble()));
+            stack->pop_back();
+            return;
+        }
+    }
+    call_built_in(*ip->built_in);
+}
+
+inline void Interpreter::arith_number_op(const Op *ip, unsigned code) {
+    if (!stack->empty() && stack->back().tag() == VALUE_NUMBER) {
+        Value &top = stack->back();
+        top = Value::fromDouble(arith(code, top.asDouble(), ip->number));
         return;
-    case VALUE_DEFINED:
-        for (Instr &sub: v.definedFunc()) {
-            if (sub.exec)
-                exec_value(sub.value);
-            else
-                push(sub.value);
+    }
+    stack->emplace_back(Value::fromDouble(ip->number));
+    call_built_in(*ip->built_in);
+}
+
+inline void Interpreter::dup_mul_op(const Op *ip) {
+    if (!stack->empty() && stack->back().tag() == VALUE_NUMBER) {
+        Value &top = stack->back();
+        double d = top.asDouble();
+        top = Value::fromDouble(d * d);
+        return;
+    }
+    call_built_in(*ip->first);
+    call_built_in(*ip->built_in);
+}
+
+inline void Interpreter::swap_sub_op(const Op *ip) {
+    std::size_t size = stack->size();
+    if (size >= 2) {
+        Value *args = stack->data() + (size - 2);
+        if (args[0].tag() == VALUE_NUMBER && args[1].tag() == VALUE_NUMBER) {
+            args[0] = Value::fromDouble(args[0].asDouble() - args[1].asDouble());
+            stack->pop_back();
+            return;
         }
+    }
+    call_built_in(*ip->first);
+    call_built_in(*ip->built_in);
+}
+
+#ifdef OTJ_DIRECT_THREADED
+// Taking the address of a label is a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+void Interpreter::run(const Op *ip) {
+    static const void *const targets[OP_COUNT] = {
+        &&push_number, &&push_value, &&call_built_in, &&call_defined, &&ret,
+        &&add, &&sub, &&mul, &&div,
+        &&add_number, &&sub_number, &&mul_number, &&div_number,
+        &&dup_mul, &&swap_sub
+    };
+    if (ip == nullptr) {
+        threaded_targets = targets;
         return;
-    default:
-        push(v);
+    }
+    std::size_t base = frames.size();
+    if (!enter(nullptr, Value::nil()))
+        return;
+#define NEXT() goto *ip->target
+
+    NEXT();
+push_number:
+    stack->emplace_back(Value::fromDouble(ip->number));
+    ++ip;
+    NEXT();
+push_value:
+    stack->push_back(*ip->value);
+    ++ip;
+    NEXT();
+call_built_in:
+    call_built_in(*ip->built_in);
+    ++ip;
+    if (has_pending || unwinding) {
+        ip = after_built_in(ip);
+        if (ip == nullptr)
+            goto unwind;
+    }
+    NEXT();
+call_defined:
+    ip = call_op(ip);
+    if (ip == nullptr)
+        goto unwind;
+    NEXT();
+add:
+    arith_op(ip, OP_ADD);
+    ++ip;
+    NEXT();
+sub:
+    arith_op(ip, OP_SUB);
+    ++ip;
+    NEXT();
+mul:
+    arith_op(ip, OP_MUL);
+    ++ip;
+    NEXT();
+div:
+    arith_op(ip, OP_DIV);
+    ++ip;
+    NEXT();
+add_number:
+    arith_number_op(ip, OP_ADD);
+    ++ip;
+    NEXT();
+sub_number:
+    arith_number_op(ip, OP_SUB);
+    ++ip;
+    NEXT();
+mul_number:
+    arith_number_op(ip, OP_MUL);
+    ++ip;
+    NEXT();
+div_number:
+    arith_number_op(ip, OP_DIV);
+    ++ip;
+    NEXT();
+dup_mul:
+    dup_mul_op(ip);
+    ++ip;
+    NEXT();
+swap_sub:
+    swap_sub_op(ip);
+    ++ip;
+    NEXT();
+ret:
+    ip = frames.back().ip;
+    frames.pop_back();
+    if (ip == nullptr)
+        return;
+    NEXT();
+unwind:
+    frames.erase(frames.begin() + base, frames.end());
+    return;
+
+#undef NEXT
+}
+
+#pragma GCC diagnostic pop
+#else
+void Interpreter::run(const Op *ip) {
+    if (ip == nullptr)
         return;
+    std::size_t base = frames.size();
+    if (!enter(nullptr, Value::nil()))
+        return;
+    while (ip != nullptr) {
+        switch (ip->code) {
+        case OP_PUSH_NUMBER:
+            stack->emplace_back(Value::fromDouble(ip->number));
+            ++ip;
+            break;
+        case OP_PUSH_VALUE:
+            stack->push_back(*ip->value);
+            ++ip;
+            break;
+        case OP_CALL_BUILT_IN:
+            call_built_in(*ip->built_in);
+            ++ip;
+            if (has_pending || unwinding)
+                ip = after_built_in(ip);
+            break;
+        case OP_CALL_DEFINED:
+            ip = call_op(ip);
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            arith_op(ip, ip->code);
+            ++ip;
+            break;
+        case OP_ADD_NUMBER:
+        case OP_SUB_NUMBER:
+        case OP_MUL_NUMBER:
+        case OP_DIV_NUMBER:
+            arith_number_op(ip, ip->code - (OP_ADD_NUMBER - OP_ADD));
+            ++ip;
+            break;
+        case OP_DUP_MUL:
+            dup_mul_op(ip);
+            ++ip;
+            break;
+        case OP_SWAP_SUB:
+            swap_sub_op(ip);
+            ++ip;
+            break;
+        case OP_RETURN:
+            ip = frames.back().ip;
+            frames.pop_back();
+            if (ip == nullptr)
+                return;
+            break;
+        }
     }
+    frames.erase(frames.begin() + base, frames.end());
 }
+#endif
 
-void Interpreter::add_built_in(std::string name, unsigned args, Native_f f) {
-    Symbol s = symtab.intern(name);
-    dict.emplace(std::pair(s, Value::built_in(s, args, f)));
+void Interpreter::add_built_in(const Built_in &b) {
+    Symbol s = symtab.intern(b.name);
+    Value v = Value::built_in(&b);
+    built_ins.define(s, v);
+    dict.define(s, std::move(v));
 }
 
 void Interpreter::push(Value v) {
@@ -142,7 +566,7 @@ void Interpreter::push(Value v) {
 }
 
 Value Interpreter::pop() {
-    Value v = stack->operator[](stack->size() - 1);
+    Value v = std::move(stack->back());
     stack->pop_back();
     return v;
 }
@@ -2,48 +2,161 @@
 #define STATE_HPP_INCLUDED
 
 #include <atomic>
-#include <boost/lockfree/spsc_queue.hpp>
 #include <functional>
+#include <memory>
 #include <queue>
-#include <unordered_map>
+#include <string>
+#include <string_view>
 #include <vector>
+#include "Dictionary.hpp"
+#include "Event_queue.hpp"
+#include "Histogram.hpp"
+#include "Note_event.hpp"
 #include "Scheduler.hpp"
 #include "Symbol.hpp"
 #include "Value.hpp"
+#include "Wakeup.hpp"
+
+struct Op;
+struct Token;
+class Worker_pool;
 
 class Interpreter {
 public:
     Interpreter();
+    // Capacities are rounded up to a power of two; policies are QUEUE_*.
+    // The scheduler holds schedule_capacity pending callbacks without
+    // allocating.
+    Interpreter(std::size_t callback_capacity, unsigned callback_policy,
+                std::size_t input_capacity, unsigned input_policy,
+                std::size_t schedule_capacity = 1 << 17);
+    ~Interpreter();
 
     void process();
-    void add_built_in(std::string name, unsigned args, Native_f f);
-    void read(const std::string &tok);
+    void add_built_in(const Built_in &b);
+    // Queues a line of any number of tokens. May be called from any number
+    // of threads. Returns false if the line was rejected because the input
+    // queue is full.
+    bool read(const std::string &line);
+    // Runs src on the calling thread, bypassing the input queue. Only for
+    // use while start() is not running.
+    void eval(std::string_view src);
+    // Maps the script at path and runs all of it with eval. Returns false
+    // if it could not be read.
+    bool load(const std::string &path);
     void push(Value v);
     Value pop();
+    // Removes the top n values.
+    void drop(std::size_t n);
+    // Replaces the top n values, n >= 1, with v.
+    void replace_top(std::size_t n, Value v);
 
+    // Runs the main loop until run is cleared. Whoever clears it must call
+    // wake() so that a parked loop notices.
     void start(std::atomic_bool &run);
+    void wake();
 
     Scheduler scheduler;
     Symbol_table symtab;
-    std::unordered_map<Symbol, Value, Symbol_hash> dict;
+    Dictionary dict;
+    // Every built-in under the name it was added with, whatever dict now
+    // binds that name to.
+    Dictionary built_ins;
     std::vector<Value> *stack;
+    Wakeup wakeup;
+    Event_queue<Due_callback> callback_queue;
+    Event_queue<std::string> input_queue;
+    // Notes for the audio thread, which drains them once per control block.
+    Event_queue<Note_event> notes;
+    // The time the code now running is meant to happen at: the deadline of
+    // a scheduled callback, or the moment interactive input was taken up.
+    // Note times are relative to it, so callbacks stay in time even when
+    // they run late.
+    Clock::time_point logical_time;
+    // Where scheduled callbacks lose time, in nanoseconds: deadline to
+    // timer expiry, expiry to the start of execution, deadline to the start
+    // of execution, and the execution itself.
+    Histogram timer_lateness;
+    Histogram queue_delay;
+    Histogram callback_lateness;
+    Histogram callback_run;
     void exec_value(Value &v);
+    // Has v executed as soon as the running built-in returns, as if the
+    // block that called the built-in had called v next. In tail position
+    // that call takes no room on the return stack, so loops written with
+    // exec and if run in constant space.
+    void exec_after(Value v);
+    // Frames the return stack may hold. A call beyond that is an error
+    // and abandons everything that is running.
+    std::size_t max_depth;
+    // Set while running code is being abandoned after an error, until
+    // control gets back to the top level. Built-ins that loop should stop.
+    bool unwinding;
+    // Compiles code into a new block value.
+    Value make_block(std::vector<Instr> code);
+
+    // Threads pmap runs on, the interpreter thread included. Only read
+    // when pmap is first used.
+    std::size_t worker_count;
+    Worker_pool &workers();
+    // A bare interpreter, with a stack and the built-ins but nothing
+    // else, for worker i of workers() to run code on.
+    Interpreter &helper(std::size_t i);
 
 private:
     std::vector<Value> main_stack;
     std::vector<Value> callback_stack;
 
-    boost::lockfree::spsc_queue<Symbol> callback_queue;
-    boost::lockfree::spsc_queue<std::string> input_queue;
-
     std::vector<std::vector<Instr>> assembling;
 
-    void process_read(const std::string &tok);
+    // Where a running block returns to, nullptr for the block run() was
+    // called with, and the block itself when its caller does not keep it
+    // alive.
+    struct Frame {
+        const Op *ip;
+        Value block;
+    };
+    std::vector<Frame> frames;
+    // Set by exec_after.
+    Value pending;
+    bool has_pending;
+    // Calls of exec_value in progress, each of them a C++ frame or more.
+    std::size_t nesting;
+
+    std::vector<std::unique_ptr<Interpreter>> helpers;
+    std::unique_ptr<Worker_pool> pool;
+
+    void process_text(std::string_view src);
+    void process_token(const Token &tok);
     void process_reference(bool exec, Symbol s);
     void process(bool exec, Value v);
 
-    void execute_callback(Symbol s);
+    void call_built_in(const Built_in &b);
+    void run(const Op *ip);
+    void overflow();
+    bool enter(const Op *ret, Value block);
+    // Control transfers of run. They return where to continue, or nullptr
+    // if running code has to be abandoned.
+    const Op *call_op(const Op *ip);
+    const Op *after_built_in(const Op *next);
+    // Superinstructions, with code the matching OP_* constant so that each
+    // handler can be specialized.
+    void arith_op(const Op *ip, unsigned code);
+    void arith_number_op(const Op *ip, unsigned code);
+    void dup_mul_op(const Op *ip);
+    void swap_sub_op(const Op *ip);
+
+    void execute_callback(const Due_callback &c);
 };
 
+inline void Interpreter::drop(std::size_t n) {
+    for (; n > 0; --n)
+        stack->pop_back();
+}
+
+inline void Interpreter::replace_top(std::size_t n, Value v) {
+    drop(n - 1);
+    stack->back() = std::move(v);
+}
 
 #endif
@@ -0,0 +1,73 @@
+#include "Lexer.hpp"
+
+#include <charconv>
+#include <system_error>
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+Lexer::Lexer(std::string_view _input): input(_input), pos(0) {}
+
+bool Lexer::next(Token &tok) {
+    for (;;) {
+        while (pos < input.size() && is_space(input[pos]))
+            ++pos;
+        if (pos == input.size())
+            return false;
+        if (input[pos] != '\\')
+            break;
+        while (pos < input.size() && input[pos] != '\n')
+            ++pos;
+    }
+
+    std::size_t start = pos;
+    while (pos < input.size() && !is_space(input[pos]))
+        ++pos;
+    std::string_view text = input.substr(start, pos - start);
+    tok.text = text;
+
+    // from_chars takes no leading '+', but "+5" has always read as 5.
+    const char *first = text.data();
+    const char *last = text.data() + text.size();
+    if (text.size() > 1 && text[0] == '+')
+        ++first;
+    std::from_chars_result r = std::from_chars(first, last, tok.number);
+    if (r.ptr == last) {
+        tok.kind = r.ec == std::errc() ? TOKEN_NUMBER : TOKEN_INVALID;
+        return true;
+    }
+
+    if (text.size() == 1) {
+        switch (text[0]) {
+        case '[':
+            tok.kind = TOKEN_OPEN;
+            break;
+        case ']':
+            tok.kind = TOKEN_CLOSE;
+            break;
+        case '$':
+        case '&':
+            tok.kind = TOKEN_INVALID;
+            break;
+        default:
+            tok.kind = TOKEN_WORD;
+            break;
+        }
+        return true;
+    }
+    switch (text[0]) {
+    case '$':
+        tok.kind = TOKEN_SYMBOL;
+        tok.text = text.substr(1);
+        break;
+    case '&':
+        tok.kind = TOKEN_QUOTE;
+        tok.text = text.substr(1);
+        break;
+    default:
+        tok.kind = TOKEN_WORD;
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef LEXER_HPP_INCLUDED
+#define LEXER_HPP_INCLUDED
+
+#include <cstddef>
+#include <string_view>
+
+#define TOKEN_NUMBER 0
+#define TOKEN_WORD 1
+#define TOKEN_OPEN 2
+#define TOKEN_CLOSE 3
+// $name: the symbol name itself.
+#define TOKEN_SYMBOL 4
+// &name: the value bound to name, without executing it.
+#define TOKEN_QUOTE 5
+#define TOKEN_INVALID 6
+
+struct Token {
+    unsigned kind;
+    // The name for words, symbols and quotes, without the sigil; the whole
+    // token otherwise.
+    std::string_view text;
+    double number;
+};
+
+// Splits a buffer into whitespace-separated tokens and classifies each one
+// as it goes, without copying or throwing. A backslash starts a comment
+// that runs to the end of the line. Tokens point into the buffer, which
+// must outlive them.
+class Lexer {
+public:
+    explicit Lexer(std::string_view _input);
+
+    // Returns false once the input is exhausted.
+    bool next(Token &tok);
+
+private:
+    std::string_view input;
+    std::size_t pos;
+};
+
+#endif
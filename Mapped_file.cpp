@@ -0,0 +1,79 @@
+#include "Mapped_file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <sstream>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+Mapped_file::Mapped_file(const std::string &path)
+    : data(nullptr), size(0), mapped(false), buffer(), message() {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        message = std::strerror(errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        message = std::strerror(errno);
+    } else if (st.st_size == 0) {
+        data = buffer.data();
+    } else {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            message = std::strerror(errno);
+        } else {
+            data = static_cast<const char *>(p);
+            size = st.st_size;
+            mapped = true;
+            // Scripts are read front to back exactly once.
+            madvise(p, size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+Mapped_file::~Mapped_file() {
+    if (mapped)
+        munmap(const_cast<char *>(data), size);
+}
+
+#else
+
+Mapped_file::Mapped_file(const std::string &path)
+    : data(nullptr), size(0), mapped(false), buffer(), message() {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        message = "cannot open file";
+        return;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    buffer = ss.str();
+    data = buffer.data();
+    size = buffer.size();
+}
+
+Mapped_file::~Mapped_file() {}
+
+#endif
+
+bool Mapped_file::ok() const {
+    return data != nullptr;
+}
+
+const std::string &Mapped_file::error() const {
+    return message;
+}
+
+std::string_view Mapped_file::contents() const {
+    return std::string_view(data, size);
+}
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_HPP_INCLUDED
+#define MAPPED_FILE_HPP_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A read-only view of a whole file. On POSIX systems the file is mapped
+// into memory rather than copied; elsewhere it is read into a buffer.
+class Mapped_file {
+public:
+    explicit Mapped_file(const std::string &path);
+    ~Mapped_file();
+
+    Mapped_file(const Mapped_file &) = delete;
+    Mapped_file &operator=(const Mapped_file &) = delete;
+
+    // False if the file could not be opened or mapped; error() says why.
+    bool ok() const;
+    const std::string &error() const;
+    std::string_view contents() const;
+
+private:
+    const char *data;
+    std::size_t size;
+    bool mapped;
+    std::string buffer;
+    std::string message;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef NOTE_EVENT_HPP_INCLUDED
+#define NOTE_EVENT_HPP_INCLUDED
+
+#include "Clock.hpp"
+
+// A note for the audio thread. It carries the absolute time at which it
+// should sound rather than a delay, so that however late the interpreter or
+// the audio thread gets to it, it still starts on the right sample.
+struct Note_event {
+    Clock::time_point at;
+    double instr;
+    double dur;
+    double amp;
+    double freq;
+};
+
+#endif
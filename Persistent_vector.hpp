@@ -0,0 +1,434 @@
+#ifndef PERSISTENT_VECTOR_HPP_INCLUDED
+#define PERSISTENT_VECTOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+
+#include "Pool.hpp"
+
+// A 32-way trie with a tail buffer, in the style of Clojure's vectors.
+// Copying a vector is O(1) and shares every node; mutating operations copy
+// the nodes they touch only while those nodes are shared with another
+// vector, so push_back, pop_back and set are O(log32 n).
+template <class T>
+class Persistent_vector {
+    static constexpr unsigned BITS = 5;
+    static constexpr std::size_t WIDTH = std::size_t(1) << BITS;
+    static constexpr std::size_t MASK = WIDTH - 1;
+
+    struct Node {
+        unsigned long refcount;
+
+        Node(): refcount(1) {}
+
+        static void *operator new(std::size_t size) { return pool_alloc(size); }
+        static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
+    };
+
+    struct Branch : Node {
+        Node *children[WIDTH];
+
+        Branch(): Node(), children() {}
+    };
+
+    struct Leaf : Node {
+        std::size_t size;
+        alignas(T) unsigned char storage[WIDTH * sizeof(T)];
+
+        Leaf(): Node(), size(0) {}
+        ~Leaf() {
+            for (std::size_t i = 0; i < size; ++i)
+                elems()[i].~T();
+        }
+
+        T *elems() {
+            return std::launder(reinterpret_cast<T *>(storage));
+        }
+        const T *elems() const {
+            return std::launder(reinterpret_cast<const T *>(storage));
+        }
+        void append(T x) {
+            new (storage + size * sizeof(T)) T(std::move(x));
+            ++size;
+        }
+    };
+
+public:
+    using size_type = std::size_t;
+    using value_type = T;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        const_iterator(const Persistent_vector *_vec, size_type _i)
+            : vec(_vec), i(_i), elems(_i < _vec->count ? _vec->leaf_elems(_i) : nullptr) {}
+
+        const T &operator*() const {
+            return elems[i & MASK];
+        }
+        const T *operator->() const {
+            return &elems[i & MASK];
+        }
+        const_iterator &operator++() {
+            ++i;
+            if ((i & MASK) == 0 && i < vec->count)
+                elems = vec->leaf_elems(i);
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const const_iterator &other) const {
+            return i == other.i;
+        }
+        bool operator!=(const const_iterator &other) const {
+            return i != other.i;
+        }
+
+    private:
+        const Persistent_vector *vec;
+        size_type i;
+        const T *elems;
+    };
+
+    Persistent_vector(): count(0), shift(BITS), root(nullptr), tail(nullptr) {}
+
+    template <class It>
+    Persistent_vector(It first, It last): Persistent_vector() {
+        for (; first != last; ++first)
+            push_back(*first);
+    }
+
+    Persistent_vector(const Persistent_vector &other)
+        : count(other.count), shift(other.shift), root(other.root), tail(other.tail) {
+        if (root != nullptr)
+            ++root->refcount;
+        if (tail != nullptr)
+            ++tail->refcount;
+    }
+
+    Persistent_vector(Persistent_vector &&other) noexcept
+        : count(other.count), shift(other.shift), root(other.root), tail(other.tail) {
+        other.count = 0;
+        other.shift = BITS;
+        other.root = nullptr;
+        other.tail = nullptr;
+    }
+
+    Persistent_vector &operator=(Persistent_vector other) noexcept {
+        std::swap(count, other.count);
+        std::swap(shift, other.shift);
+        std::swap(root, other.root);
+        std::swap(tail, other.tail);
+        return *this;
+    }
+
+    ~Persistent_vector() {
+        if (root != nullptr)
+            release(root, shift);
+        if (tail != nullptr)
+            release(tail, 0);
+    }
+
+    size_type size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const T &operator[](size_type i) const {
+        return leaf_elems(i)[i & MASK];
+    }
+
+    const T &back() const {
+        return (*this)[count - 1];
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, count);
+    }
+
+    void push_back(T x) {
+        if (tail == nullptr) {
+            tail = new Leaf;
+        } else if (tail->size == WIDTH) {
+            if (root == nullptr) {
+                root = new Branch;
+                root->children[0] = tail;
+            } else if ((count >> BITS) > (size_type(1) << shift)) {
+                Branch *new_root = new Branch;
+                new_root->children[0] = root;
+                new_root->children[1] = new_path(shift, tail);
+                root = new_root;
+                shift += BITS;
+            } else {
+                root = push_tail(shift, root, tail);
+            }
+            tail = new Leaf;
+        } else {
+            tail = own(tail);
+        }
+        tail->append(std::move(x));
+        ++count;
+    }
+
+    void pop_back() {
+        if (tail->size > 1 || root == nullptr) {
+            tail = own(tail);
+            --tail->size;
+            tail->elems()[tail->size].~T();
+            if (tail->size == 0) {
+                release(tail, 0);
+                tail = nullptr;
+            }
+        } else {
+            Leaf *new_tail = static_cast<Leaf *>(leaf_for(count - 2));
+            ++new_tail->refcount;
+            release(tail, 0);
+            tail = new_tail;
+            root = static_cast<Branch *>(pop_tail(shift, root));
+            if (root == nullptr) {
+                shift = BITS;
+            } else if (shift > BITS && root->children[1] == nullptr) {
+                Branch *old_root = root;
+                root = static_cast<Branch *>(old_root->children[0]);
+                old_root->children[0] = nullptr;
+                delete old_root;
+                shift -= BITS;
+            }
+        }
+        --count;
+    }
+
+    void set(size_type i, T x) {
+        if (i >= tail_offset()) {
+            tail = own(tail);
+            tail->elems()[i & MASK] = std::move(x);
+        } else {
+            root = static_cast<Branch *>(set_in(shift, root, i, std::move(x)));
+        }
+    }
+
+    // Elements held in nodes that no other vector shares, counted until
+    // there are limit of them.
+    size_type owned(size_type limit) const {
+        size_type n = 0;
+        count_owned(tail, 0, limit, n);
+        count_owned(root, shift, limit, n);
+        return n;
+    }
+
+    // Takes the vector apart for good, until about budget elements and
+    // shared nodes have been released, and returns whether it is empty.
+    // Nodes that another vector still refers to are released whole, never
+    // copied. Until it returns true the vector may only be destroyed or
+    // passed back in.
+    bool release_some(size_type &budget) {
+        while (budget > 0) {
+            if (tail != nullptr) {
+                charge(budget, take(tail, 0));
+                tail = nullptr;
+                continue;
+            }
+            if (root == nullptr) {
+                count = 0;
+                shift = BITS;
+                return true;
+            }
+            // Down the rightmost path of nodes of our own to the first
+            // node that is shared, is a leaf or has nothing left under it.
+            Node *top = root;
+            Node **link = &top;
+            unsigned level = shift;
+            for (;;) {
+                Node *node = *link;
+                Node **child = level == 0 ? nullptr : last_child(static_cast<Branch *>(node));
+                if (node->refcount > 1 || child == nullptr) {
+                    charge(budget, take(node, level));
+                    *link = nullptr;
+                    break;
+                }
+                link = child;
+                level -= BITS;
+            }
+            root = static_cast<Branch *>(top);
+        }
+        return tail == nullptr && root == nullptr;
+    }
+
+private:
+    size_type count;
+    unsigned shift;
+    Branch *root;
+    Leaf *tail;
+
+    size_type tail_offset() const {
+        return count == 0 ? 0 : ((count - 1) >> BITS) << BITS;
+    }
+
+    Node *leaf_for(size_type i) const {
+        if (i >= tail_offset())
+            return tail;
+        Node *node = root;
+        for (unsigned level = shift; level > 0; level -= BITS)
+            node = static_cast<Branch *>(node)->children[(i >> level) & MASK];
+        return node;
+    }
+
+    const T *leaf_elems(size_type i) const {
+        return static_cast<const Leaf *>(leaf_for(i))->elems();
+    }
+
+    static void release(Node *node, unsigned level) {
+        if (node->refcount > 1) {
+            --node->refcount;
+            return;
+        }
+        if (level == 0) {
+            delete static_cast<Leaf *>(node);
+        } else {
+            Branch *branch = static_cast<Branch *>(node);
+            for (Node *child : branch->children) {
+                if (child != nullptr)
+                    release(child, level - BITS);
+            }
+            delete branch;
+        }
+    }
+
+    static void count_owned(const Node *node, unsigned level, size_type limit, size_type &n) {
+        if (node == nullptr || node->refcount > 1 || n >= limit)
+            return;
+        if (level == 0) {
+            n += static_cast<const Leaf *>(node)->size;
+            return;
+        }
+        for (const Node *child : static_cast<const Branch *>(node)->children)
+            count_owned(child, level - BITS, limit, n);
+    }
+
+    static Node **last_child(Branch *branch) {
+        for (size_type i = WIDTH; i-- > 0;) {
+            if (branch->children[i] != nullptr)
+                return &branch->children[i];
+        }
+        return nullptr;
+    }
+
+    // Drops one reference to node, which unless it is shared is a leaf or
+    // a branch with no children left, and returns what that cost.
+    static size_type take(Node *node, unsigned level) {
+        if (node->refcount > 1) {
+            --node->refcount;
+            return 1;
+        }
+        if (level > 0) {
+            delete static_cast<Branch *>(node);
+            return 1;
+        }
+        Leaf *leaf = static_cast<Leaf *>(node);
+        size_type n = leaf->size;
+        delete leaf;
+        return n == 0 ? 1 : n;
+    }
+
+    static void charge(size_type &budget, size_type cost) {
+        budget = cost >= budget ? 0 : budget - cost;
+    }
+
+    // Takes over a reference to node and returns a node with the same
+    // contents that no other vector can observe.
+    static Leaf *own(Leaf *leaf) {
+        if (leaf->refcount == 1)
+            return leaf;
+        Leaf *copy = new Leaf;
+        for (size_type i = 0; i < leaf->size; ++i)
+            copy->append(leaf->elems()[i]);
+        --leaf->refcount;
+        return copy;
+    }
+
+    static Branch *own(Branch *branch) {
+        if (branch->refcount == 1)
+            return branch;
+        Branch *copy = new Branch;
+        for (size_type i = 0; i < WIDTH; ++i) {
+            copy->children[i] = branch->children[i];
+            if (copy->children[i] != nullptr)
+                ++copy->children[i]->refcount;
+        }
+        --branch->refcount;
+        return copy;
+    }
+
+    static Node *new_path(unsigned level, Node *leaf) {
+        if (level == 0)
+            return leaf;
+        Branch *branch = new Branch;
+        branch->children[0] = new_path(level - BITS, leaf);
+        return branch;
+    }
+
+    Branch *push_tail(unsigned level, Branch *parent, Leaf *leaf) {
+        parent = own(parent);
+        size_type sub = ((count - 1) >> level) & MASK;
+        Node *child = parent->children[sub];
+        if (level == BITS)
+            parent->children[sub] = leaf;
+        else if (child != nullptr)
+            parent->children[sub] = push_tail(level - BITS, static_cast<Branch *>(child), leaf);
+        else
+            parent->children[sub] = new_path(level - BITS, leaf);
+        return parent;
+    }
+
+    Node *pop_tail(unsigned level, Branch *node) {
+        size_type sub = ((count - 2) >> level) & MASK;
+        if (level > BITS) {
+            node = own(node);
+            node->children[sub] = pop_tail(level - BITS, static_cast<Branch *>(node->children[sub]));
+            if (node->children[sub] == nullptr && sub == 0) {
+                release(node, level);
+                return nullptr;
+            }
+            return node;
+        }
+        if (sub == 0) {
+            release(node, level);
+            return nullptr;
+        }
+        node = own(node);
+        release(node->children[sub], 0);
+        node->children[sub] = nullptr;
+        return node;
+    }
+
+    Node *set_in(unsigned level, Node *node, size_type i, T x) {
+        if (level == 0) {
+            Leaf *leaf = own(static_cast<Leaf *>(node));
+            leaf->elems()[i & MASK] = std::move(x);
+            return leaf;
+        }
+        Branch *branch = own(static_cast<Branch *>(node));
+        size_type sub = (i >> level) & MASK;
+        branch->children[sub] = set_in(level - BITS, branch->children[sub], i, std::move(x));
+        return branch;
+    }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "Pool.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+// Multiples of 16, so every block keeps the alignment of the chunk it was
+// carved from. 288 fits the leaves and branches of a vector of Values.
+static constexpr std::size_t class_sizes[POOL_CLASSES] = {
+    32, 48, 64, 96, 128, 192, 288, 384, 512, 768, 1024
+};
+
+// Blocks move between a thread and the depot this many at a time.
+static const unsigned BATCH = 64;
+
+// A free block. The first block of a batch in the depot also links to the
+// next batch and knows the length of its own.
+struct Block {
+    Block *next;
+    Block *next_batch;
+    std::size_t count;
+};
+
+struct Class_table {
+    unsigned char of[POOL_MAX_SIZE / 16 + 1];
+
+    constexpr Class_table(): of() {
+        unsigned c = 0;
+        for (std::size_t i = 0; i <= POOL_MAX_SIZE / 16; ++i) {
+            while (class_sizes[c] < i * 16)
+                ++c;
+            of[i] = static_cast<unsigned char>(c);
+        }
+    }
+};
+
+static constexpr Class_table class_table;
+
+static unsigned class_of(std::size_t size) {
+    return class_table.of[(size + 15) / 16];
+}
+
+struct Depot {
+    std::mutex mutex;
+    Block *batches[POOL_CLASSES];
+    std::uint64_t blocks[POOL_CLASSES];
+    std::uint64_t in_depot[POOL_CLASSES];
+    std::uint64_t chunks;
+    std::atomic<std::uint64_t> large;
+
+    Depot(): mutex(), batches(), blocks(), in_depot(), chunks(0), large(0) {}
+};
+
+// Never destroyed, so cells released by static destructors still have
+// somewhere to go.
+static Depot &depot() {
+    static Depot *d = new Depot;
+    return *d;
+}
+
+// Trivially constructed and destroyed, so it can be used from any point in
+// a thread's life without an initialisation check.
+struct Cache {
+    Block *head[POOL_CLASSES];
+    unsigned count[POOL_CLASSES];
+    bool armed;
+};
+
+static thread_local Cache cache;
+
+// Hands the blocks of an exiting thread back to the depot.
+struct Cache_guard {
+    ~Cache_guard();
+    void arm() {}
+};
+
+static thread_local Cache_guard guard;
+
+static void push_batch(Depot &d, unsigned c, Block *first, std::size_t count) {
+    first->next_batch = d.batches[c];
+    first->count = count;
+    d.batches[c] = first;
+    d.in_depot[c] += count;
+}
+
+Cache_guard::~Cache_guard() {
+    Depot &d = depot();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    for (unsigned c = 0; c < POOL_CLASSES; ++c) {
+        if (cache.head[c] != nullptr)
+            push_batch(d, c, cache.head[c], cache.count[c]);
+        cache.head[c] = nullptr;
+        cache.count[c] = 0;
+    }
+}
+
+// Carves a new chunk into a batch of blocks. The depot must be locked.
+static Block *grow(Depot &d, unsigned c) {
+    std::size_t size = class_sizes[c];
+    unsigned char *chunk = static_cast<unsigned char *>(::operator new(BATCH * size));
+    Block *next = nullptr;
+    for (unsigned i = BATCH; i-- > 0;)
+        next = new (chunk + i * size) Block{next, nullptr, 0};
+    next->count = BATCH;
+    ++d.chunks;
+    d.blocks[c] += BATCH;
+    return next;
+}
+
+static void *refill(unsigned c) {
+    if (!cache.armed) {
+        cache.armed = true;
+        guard.arm();
+    }
+    Depot &d = depot();
+    Block *b;
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        b = d.batches[c];
+        if (b != nullptr) {
+            d.batches[c] = b->next_batch;
+            d.in_depot[c] -= b->count;
+        } else {
+            b = grow(d, c);
+        }
+    }
+    cache.head[c] = b->next;
+    cache.count[c] = static_cast<unsigned>(b->count - 1);
+    return b;
+}
+
+static void spill(unsigned c) {
+    Block *first = cache.head[c];
+    Block *last = first;
+    for (unsigned i = 1; i < BATCH; ++i)
+        last = last->next;
+    cache.head[c] = last->next;
+    cache.count[c] -= BATCH;
+    last->next = nullptr;
+    Depot &d = depot();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    push_batch(d, c, first, BATCH);
+}
+
+void *pool_alloc(std::size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        depot().large.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+    unsigned c = class_of(size);
+    Block *b = cache.head[c];
+    if (b == nullptr)
+        return refill(c);
+    cache.head[c] = b->next;
+    --cache.count[c];
+    return b;
+}
+
+void pool_free(void *p, std::size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+    unsigned c = class_of(size);
+    cache.head[c] = new (p) Block{cache.head[c], nullptr, 0};
+    if (++cache.count[c] >= 2 * BATCH)
+        spill(c);
+}
+
+void pool_reserve(std::size_t bytes) {
+    Depot &d = depot();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    for (unsigned c = 0; c < POOL_CLASSES; ++c) {
+        std::size_t batch_bytes = BATCH * class_sizes[c];
+        for (std::size_t have = d.in_depot[c] * class_sizes[c]; have < bytes; have += batch_bytes)
+            push_batch(d, c, grow(d, c), BATCH);
+    }
+}
+
+Pool_stats pool_stats() {
+    Depot &d = depot();
+    Pool_stats stats;
+    std::lock_guard<std::mutex> lock(d.mutex);
+    for (unsigned c = 0; c < POOL_CLASSES; ++c)
+        stats.classes[c] = {class_sizes[c], d.blocks[c], d.in_depot[c]};
+    stats.chunks = d.chunks;
+    stats.large = d.large.load(std::memory_order_relaxed);
+    return stats;
+}
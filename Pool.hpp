@@ -0,0 +1,40 @@
+#ifndef POOL_HPP_INCLUDED
+#define POOL_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#define POOL_CLASSES 11
+#define POOL_MAX_SIZE 1024
+
+// A size-class allocator for heap cells and the nodes of their element
+// storage. Each thread keeps a free list per class and trades blocks in
+// batches with a shared depot, which only takes memory from the global
+// heap when it runs dry. Blocks may be freed on any thread; they join the
+// free list of the thread that frees them. Sizes above POOL_MAX_SIZE go
+// straight to operator new.
+void *pool_alloc(std::size_t size);
+void pool_free(void *p, std::size_t size);
+
+// Fills the depot up to at least bytes bytes of blocks of every class, so
+// that allocations after startup need not reach the global heap.
+void pool_reserve(std::size_t bytes);
+
+struct Pool_stats {
+    struct Size_class {
+        std::size_t size;
+        // Blocks carved so far, and how many of them sit in the depot.
+        std::uint64_t blocks;
+        std::uint64_t in_depot;
+    };
+
+    Size_class classes[POOL_CLASSES];
+    // Calls into the global heap: chunks carved into blocks, and
+    // allocations too large for any class.
+    std::uint64_t chunks;
+    std::uint64_t large;
+};
+
+Pool_stats pool_stats();
+
+#endif
@@ -1,58 +1,133 @@
 #include "Scheduler.hpp"
 
-#include <memory>
+#include <algorithm>
 
-#include <iostream>
+Callback_event::Callback_event(Symbol _func, std::int32_t _clock, double _beat)
+    : func(_func), clock(_clock), beat(_beat) {}
 
-struct Callback_event {
-    Symbol func;
-    boost::asio::high_resolution_timer timer;
-    Scheduler *scheduler;
+Scheduler::Scheduler(std::function<void(const Due_callback &)> _executor, std::size_t capacity)
+    : callback_executor(_executor), mutex(), wake(), running(true),
+      pool(), free_events(), heap(), due(), clocks(), clock_index() {
+    pool.reserve(capacity);
+    free_events.reserve(capacity);
+    heap.reserve(capacity);
+    due.reserve(capacity);
+}
 
-    Callback_event(Symbol _func, boost::asio::io_context &io, Scheduler *sched);
+bool Scheduler::later(const Deadline &a, const Deadline &b) {
+    return a.at > b.at;
+}
 
-    void operator()(const boost::system::error_code &e) {
-        switch (e.value()) {
-        case boost::system::errc::success:
-            scheduler->callback_executor(func);
-            break;
-        default:
-            return;
+void Scheduler::start() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (heap.empty()) {
+            wake.wait(lock);
+            continue;
+        }
+        Clock::time_point now = std::chrono::steady_clock::now();
+        if (heap.front().at > now) {
+            wake.wait_until(lock, heap.front().at);
+            continue;
+        }
+        while (!heap.empty() && heap.front().at <= now) {
+            Deadline d = heap.front();
+            std::pop_heap(heap.begin(), heap.end(), later);
+            heap.pop_back();
+            due.push_back(Due_callback{pool[d.event].func, d.at, now});
+            free_events.push_back(d.event);
+        }
+        // Fire without the lock: the executor may block on a full queue
+        // while the interpreter schedules more events.
+        lock.unlock();
+        for (Due_callback &c : due) {
+            c.fired = std::chrono::steady_clock::now();
+            callback_executor(c);
         }
+        due.clear();
+        lock.lock();
     }
-};
+}
 
-Callback_event::Callback_event(Symbol _func, boost::asio::io_context &io, Scheduler *sched)
-    : func(_func), timer(io), scheduler(sched) {}
+void Scheduler::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+    wake.notify_one();
+}
 
-Scheduler::Scheduler(std::function<void(Symbol)> _executor): callback_executor(_executor), io(), clocks() {}
+void Scheduler::make_clock(const Symbol &s, double tempo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = clock_index.find(s);
+    if (it == clock_index.end()) {
+        clock_index.emplace(s, static_cast<std::int32_t>(clocks.size()));
+        clocks.emplace_back(tempo);
+    } else {
+        clocks[it->second] = Clock(tempo);
+        retime(it->second);
+    }
+}
 
-void Scheduler::start() {
-    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
-       guard = boost::asio::make_work_guard(io);
-    io.run();
+bool Scheduler::set_tempo(const Symbol &s, double tempo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = clock_index.find(s);
+    if (it == clock_index.end())
+        return false;
+    clocks[it->second].set_tempo(std::chrono::steady_clock::now(), tempo);
+    retime(it->second);
+    return true;
 }
 
-void Scheduler::make_clock(const Symbol &s, double tempo) {
-    clocks.insert(std::pair(s, Clock(tempo)));
-}
-
-void Scheduler::schedule_callback(const Symbol *clock, const Symbol &s, double t) {
-    io.post([this, clock, s, t](){
-        if (clock == nullptr) {
-            std::unique_ptr<Callback_event> ptr = std::make_unique<Callback_event>(s, io, this);
-            ptr->timer.expires_after(std::chrono::duration_cast< std::chrono::duration<long int, std::ratio<1, 1000000000>> >(
-                        std::chrono::duration<double>(t)));
-            ptr->timer.async_wait([ptr = std::move(ptr)](const boost::system::error_code &e) {
-                ptr->operator()(e);
-            });
-        } else {
-            auto it = clocks.find(*clock);
-            if (it == clocks.end()) {
-                std::cerr << "Unknown clock\n";
-                return;
-            }
-        }
-    });
+bool Scheduler::beat(const Symbol &s, double &beat) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = clock_index.find(s);
+    if (it == clock_index.end())
+        return false;
+    beat = clocks[it->second].beat_at(std::chrono::steady_clock::now());
+    return true;
+}
+
+void Scheduler::retime(std::int32_t clock) {
+    for (Deadline &d : heap) {
+        const Callback_event &ev = pool[d.event];
+        if (ev.clock == clock)
+            d.at = clocks[clock].time_at(ev.beat);
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+    wake.notify_one();
 }
 
+bool Scheduler::schedule_callback(const Symbol *clock, const Symbol &s, double t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::int32_t c = -1;
+    Clock::time_point at;
+    if (clock == nullptr) {
+        at = std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<Clock::time_point::duration>(std::chrono::duration<double>(t));
+    } else {
+        auto it = clock_index.find(*clock);
+        if (it == clock_index.end())
+            return false;
+        c = it->second;
+        at = clocks[c].time_at(t);
+    }
+
+    std::uint32_t event;
+    if (free_events.empty()) {
+        event = pool.size();
+        pool.emplace_back(s, c, t);
+    } else {
+        event = free_events.back();
+        free_events.pop_back();
+        pool[event] = Callback_event(s, c, t);
+    }
+    heap.push_back(Deadline{at, event});
+    std::push_heap(heap.begin(), heap.end(), later);
+    if (heap.front().event == event)
+        wake.notify_one();
+    return true;
+}
+
+std::size_t Scheduler::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return heap.size();
+}
@@ -1,24 +1,75 @@
 #pragma once
 
-#include <boost/asio.hpp>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 #include "Symbol.hpp"
 #include "Clock.hpp"
 
+struct Callback_event {
+    Symbol func;
+    // Index into Scheduler::clocks, or -1 for events timed in seconds.
+    std::int32_t clock;
+    double beat;
+
+    Callback_event(Symbol _func, std::int32_t _clock, double _beat);
+};
+
+// What the executor receives: the callback, the time it was due and the
+// time the timer actually fired it.
+struct Due_callback {
+    Symbol func;
+    Clock::time_point deadline;
+    Clock::time_point fired;
+};
+
+// Pending callbacks live in a pool of Callback_events ordered by a binary
+// min-heap of deadlines. A single thread sleeps until the earliest deadline
+// and then fires every event that is due in one go. Storage is reserved up
+// front for `capacity` pending events, so scheduling within that bound
+// never allocates.
 class Scheduler {
 public:
-    Scheduler(std::function<void(Symbol)> _executor);
+    Scheduler(std::function<void(const Due_callback &)> _executor, std::size_t capacity = 1 << 17);
 
     void start();
+    void stop();
 
+    // Clocks may be created, changed and read from any thread.
     void make_clock(const Symbol &s, double tempo);
-    void schedule_callback(const Symbol *clock, const Symbol &s, double t);
+    bool set_tempo(const Symbol &s, double tempo);
+    bool beat(const Symbol &s, double &beat);
 
-    friend class Callback_event;
+    // Without a clock, t is a delay in seconds; with one, it is the
+    // absolute beat on that clock at which s should run. Returns false if
+    // the clock does not exist.
+    bool schedule_callback(const Symbol *clock, const Symbol &s, double t);
+
+    std::size_t pending();
 
 private:
-    std::function<void(Symbol)> callback_executor;
-    boost::asio::io_context io;
-    std::unordered_map<Symbol, Clock, Symbol_hash> clocks;
+    struct Deadline {
+        Clock::time_point at;
+        std::uint32_t event;
+    };
+
+    std::function<void(const Due_callback &)> callback_executor;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+
+    std::vector<Callback_event> pool;
+    std::vector<std::uint32_t> free_events;
+    std::vector<Deadline> heap;
+    // Events fired by the current wake-up; only used by the timer thread.
+    std::vector<Due_callback> due;
+
+    std::vector<Clock> clocks;
+    std::unordered_map<Symbol, std::int32_t, Symbol_hash> clock_index;
+
+    static bool later(const Deadline &a, const Deadline &b);
+    void retime(std::int32_t clock);
 };
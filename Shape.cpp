@@ -0,0 +1,48 @@
+#include "Shape.hpp"
+
+#include <cstddef>
+#include <mutex>
+
+// Beyond this many shapes, scripts that make objects with ever new sets of
+// keys get general maps rather than growing the tree without bound.
+#define SHAPE_LIMIT 100000
+
+static std::mutex shapes_mutex;
+static std::size_t shape_count = 1;
+
+Shape::Shape(): count(0), keys(), first_child(nullptr), next_sibling(nullptr) {}
+
+Shape::Shape(const Shape &parent, Symbol key)
+    : count(parent.count + 1), keys(), first_child(nullptr), next_sibling(nullptr) {
+    for (unsigned i = 0; i < parent.count; ++i)
+        keys[i] = parent.keys[i];
+    keys[parent.count] = key;
+}
+
+const Shape *Shape::empty() {
+    static const Shape *root = new Shape;
+    return root;
+}
+
+const Shape *Shape::with(Symbol key) const {
+    if (count == SHAPE_MAX_SLOTS)
+        return nullptr;
+    for (const Shape *c = first_child.load(std::memory_order_acquire); c != nullptr; c = c->next_sibling) {
+        if (c->keys[count].id == key.id)
+            return c;
+    }
+
+    std::lock_guard<std::mutex> lock(shapes_mutex);
+    const Shape *head = first_child.load(std::memory_order_relaxed);
+    for (const Shape *c = head; c != nullptr; c = c->next_sibling) {
+        if (c->keys[count].id == key.id)
+            return c;
+    }
+    if (shape_count >= SHAPE_LIMIT)
+        return nullptr;
+    Shape *child = new Shape(*this, key);
+    child->next_sibling = head;
+    first_child.store(child, std::memory_order_release);
+    ++shape_count;
+    return child;
+}
@@ -0,0 +1,56 @@
+#ifndef SHAPE_HPP_INCLUDED
+#define SHAPE_HPP_INCLUDED
+
+#include <atomic>
+#include "Symbol.hpp"
+
+// Most fields an object can keep in slots.
+#define SHAPE_MAX_SLOTS 8
+
+// The symbol keys of an object, in the order they were added, each naming
+// the slot of the same index. Objects that gained the same keys in the
+// same order share one shape, so a shape is all they need besides a flat
+// array of values. Shapes form a tree under empty(), each child adding one
+// key to its parent, and are never freed.
+class Shape {
+public:
+    static const Shape *empty();
+
+    // The shape with key added as its last slot, or nullptr if this one is
+    // full or so many shapes exist that objects should keep a general map
+    // instead. Any thread may call it.
+    const Shape *with(Symbol key) const;
+    // The slot of key, or -1 if it has none.
+    int slot(Symbol key) const;
+    unsigned size() const;
+    Symbol key(unsigned slot) const;
+
+private:
+    Shape();
+    Shape(const Shape &parent, Symbol key);
+
+    unsigned count;
+    Symbol keys[SHAPE_MAX_SLOTS];
+    // Children are pushed onto this list under a lock and published with a
+    // release store, so that with() finds existing ones without locking.
+    mutable std::atomic<const Shape *> first_child;
+    const Shape *next_sibling;
+};
+
+inline int Shape::slot(Symbol key) const {
+    for (unsigned i = 0; i < count; ++i) {
+        if (keys[i].id == key.id)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+inline unsigned Shape::size() const {
+    return count;
+}
+
+inline Symbol Shape::key(unsigned slot) const {
+    return keys[slot];
+}
+
+#endif
@@ -0,0 +1,251 @@
+#include "Simd.hpp"
+
+// Each target defines Vec, WIDTH and the handful of v_ operations the
+// kernels below are written in terms of. Comparisons give all ones or all
+// zeros per lane, which v_mask() turns into 1 or 0.
+#if defined(__AVX__)
+#include <immintrin.h>
+
+using Vec = __m256d;
+static constexpr std::size_t WIDTH = 4;
+
+static inline Vec v_load(const double *p) { return _mm256_loadu_pd(p); }
+static inline void v_store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+static inline Vec v_splat(double d) { return _mm256_set1_pd(d); }
+static inline Vec v_add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+static inline Vec v_sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+static inline Vec v_mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+static inline Vec v_div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+static inline Vec v_min(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+static inline Vec v_max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+static inline Vec v_lt(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+static inline Vec v_gt(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+static inline Vec v_le(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+static inline Vec v_ge(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+static inline Vec v_mask(Vec m) { return _mm256_and_pd(m, v_splat(1.0)); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+using Vec = __m128d;
+static constexpr std::size_t WIDTH = 2;
+
+static inline Vec v_load(const double *p) { return _mm_loadu_pd(p); }
+static inline void v_store(double *p, Vec v) { _mm_storeu_pd(p, v); }
+static inline Vec v_splat(double d) { return _mm_set1_pd(d); }
+static inline Vec v_add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+static inline Vec v_sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+static inline Vec v_mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+static inline Vec v_div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+static inline Vec v_min(Vec a, Vec b) { return _mm_min_pd(a, b); }
+static inline Vec v_max(Vec a, Vec b) { return _mm_max_pd(a, b); }
+static inline Vec v_lt(Vec a, Vec b) { return _mm_cmplt_pd(a, b); }
+static inline Vec v_gt(Vec a, Vec b) { return _mm_cmpgt_pd(a, b); }
+static inline Vec v_le(Vec a, Vec b) { return _mm_cmple_pd(a, b); }
+static inline Vec v_ge(Vec a, Vec b) { return _mm_cmpge_pd(a, b); }
+static inline Vec v_mask(Vec m) { return _mm_and_pd(m, v_splat(1.0)); }
+#else
+using Vec = double;
+static constexpr std::size_t WIDTH = 1;
+
+static inline Vec v_load(const double *p) { return *p; }
+static inline void v_store(double *p, Vec v) { *p = v; }
+static inline Vec v_splat(double d) { return d; }
+static inline Vec v_add(Vec a, Vec b) { return a + b; }
+static inline Vec v_sub(Vec a, Vec b) { return a - b; }
+static inline Vec v_mul(Vec a, Vec b) { return a * b; }
+static inline Vec v_div(Vec a, Vec b) { return a / b; }
+static inline Vec v_min(Vec a, Vec b) { return a < b ? a : b; }
+static inline Vec v_max(Vec a, Vec b) { return a > b ? a : b; }
+static inline Vec v_lt(Vec a, Vec b) { return a < b; }
+static inline Vec v_gt(Vec a, Vec b) { return a > b; }
+static inline Vec v_le(Vec a, Vec b) { return a <= b; }
+static inline Vec v_ge(Vec a, Vec b) { return a >= b; }
+static inline Vec v_mask(Vec m) { return m; }
+#endif
+
+// The same operations on single doubles, for the elements left over after
+// the last full vector. min and max match the vector instructions, which
+// return the second operand when either is NaN.
+static inline double min1(double a, double b) { return a < b ? a : b; }
+static inline double max1(double a, double b) { return a > b ? a : b; }
+
+template <unsigned OP, class T>
+static inline T apply(T x, T y) {
+    if constexpr (OP == SIMD_ADD)
+        return v_add(x, y);
+    else if constexpr (OP == SIMD_SUB)
+        return v_sub(x, y);
+    else if constexpr (OP == SIMD_MUL)
+        return v_mul(x, y);
+    else if constexpr (OP == SIMD_DIV)
+        return v_div(x, y);
+    else if constexpr (OP == SIMD_LT)
+        return v_mask(v_lt(x, y));
+    else if constexpr (OP == SIMD_GT)
+        return v_mask(v_gt(x, y));
+    else if constexpr (OP == SIMD_LE)
+        return v_mask(v_le(x, y));
+    else
+        return v_mask(v_ge(x, y));
+}
+
+template <unsigned OP>
+static inline double apply1(double x, double y) {
+    if constexpr (OP == SIMD_ADD)
+        return x + y;
+    else if constexpr (OP == SIMD_SUB)
+        return x - y;
+    else if constexpr (OP == SIMD_MUL)
+        return x * y;
+    else if constexpr (OP == SIMD_DIV)
+        return x / y;
+    else if constexpr (OP == SIMD_LT)
+        return x < y;
+    else if constexpr (OP == SIMD_GT)
+        return x > y;
+    else if constexpr (OP == SIMD_LE)
+        return x <= y;
+    else
+        return x >= y;
+}
+
+// Specialized on which operands are broadcast, so that the loop loads
+// only what it has to.
+template <unsigned OP, bool X_SCALAR, bool Y_SCALAR>
+static void binary(const double *x, const double *y, double *out, std::size_t n) {
+    Vec xs = v_splat(*x);
+    Vec ys = v_splat(*y);
+    std::size_t i = 0;
+    for (; i + WIDTH <= n; i += WIDTH) {
+        Vec a = X_SCALAR ? xs : v_load(x + i);
+        Vec b = Y_SCALAR ? ys : v_load(y + i);
+        v_store(out + i, apply<OP>(a, b));
+    }
+    for (; i < n; ++i)
+        out[i] = apply1<OP>(X_SCALAR ? *x : x[i], Y_SCALAR ? *y : y[i]);
+}
+
+template <unsigned OP>
+static void binary(const double *x, std::size_t x_step,
+                   const double *y, std::size_t y_step, double *out, std::size_t n) {
+    if (x_step == 0 && y_step == 0)
+        binary<OP, true, true>(x, y, out, n);
+    else if (x_step == 0)
+        binary<OP, true, false>(x, y, out, n);
+    else if (y_step == 0)
+        binary<OP, false, true>(x, y, out, n);
+    else
+        binary<OP, false, false>(x, y, out, n);
+}
+
+std::size_t simd_width() {
+    return WIDTH;
+}
+
+void simd_binary(unsigned op, const double *x, std::size_t x_step,
+                 const double *y, std::size_t y_step, double *out, std::size_t n) {
+    if (n == 0)
+        return;
+    switch (op) {
+    case SIMD_ADD:
+        binary<SIMD_ADD>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_SUB:
+        binary<SIMD_SUB>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_MUL:
+        binary<SIMD_MUL>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_DIV:
+        binary<SIMD_DIV>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_LT:
+        binary<SIMD_LT>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_GT:
+        binary<SIMD_GT>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_LE:
+        binary<SIMD_LE>(x, x_step, y, y_step, out, n);
+        break;
+    case SIMD_GE:
+        binary<SIMD_GE>(x, x_step, y, y_step, out, n);
+        break;
+    }
+}
+
+// Folds the lanes of v into one double with f.
+template <class F>
+static inline double horizontal(Vec v, F f) {
+    double lanes[WIDTH];
+    v_store(lanes, v);
+    double r = lanes[0];
+    for (std::size_t i = 1; i < WIDTH; ++i)
+        r = f(r, lanes[i]);
+    return r;
+}
+
+static double plus(double a, double b) {
+    return a + b;
+}
+
+double simd_sum(const double *x, std::size_t n) {
+    // Two accumulators hide the latency of the additions.
+    Vec s0 = v_splat(0.0);
+    Vec s1 = v_splat(0.0);
+    std::size_t i = 0;
+    for (; i + 2 * WIDTH <= n; i += 2 * WIDTH) {
+        s0 = v_add(s0, v_load(x + i));
+        s1 = v_add(s1, v_load(x + i + WIDTH));
+    }
+    for (; i + WIDTH <= n; i += WIDTH)
+        s0 = v_add(s0, v_load(x + i));
+    double sum = horizontal(v_add(s0, s1), plus);
+    for (; i < n; ++i)
+        sum += x[i];
+    return sum;
+}
+
+double simd_dot(const double *x, const double *y, std::size_t n) {
+    Vec s0 = v_splat(0.0);
+    Vec s1 = v_splat(0.0);
+    std::size_t i = 0;
+    for (; i + 2 * WIDTH <= n; i += 2 * WIDTH) {
+        s0 = v_add(s0, v_mul(v_load(x + i), v_load(y + i)));
+        s1 = v_add(s1, v_mul(v_load(x + i + WIDTH), v_load(y + i + WIDTH)));
+    }
+    for (; i + WIDTH <= n; i += WIDTH)
+        s0 = v_add(s0, v_mul(v_load(x + i), v_load(y + i)));
+    double sum = horizontal(v_add(s0, s1), plus);
+    for (; i < n; ++i)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+double simd_min(const double *x, std::size_t n) {
+    std::size_t i = 0;
+    double m = x[0];
+    if (n >= WIDTH) {
+        Vec v = v_load(x);
+        for (i = WIDTH; i + WIDTH <= n; i += WIDTH)
+            v = v_min(v, v_load(x + i));
+        m = horizontal(v, min1);
+    }
+    for (; i < n; ++i)
+        m = min1(m, x[i]);
+    return m;
+}
+
+double simd_max(const double *x, std::size_t n) {
+    std::size_t i = 0;
+    double m = x[0];
+    if (n >= WIDTH) {
+        Vec v = v_load(x);
+        for (i = WIDTH; i + WIDTH <= n; i += WIDTH)
+            v = v_max(v, v_load(x + i));
+        m = horizontal(v, max1);
+    }
+    for (; i < n; ++i)
+        m = max1(m, x[i]);
+    return m;
+}
@@ -0,0 +1,35 @@
+#ifndef SIMD_HPP_INCLUDED
+#define SIMD_HPP_INCLUDED
+
+#include <cstddef>
+
+// Element-wise operations. Comparisons give 1 where they hold and 0 where
+// they do not.
+#define SIMD_ADD 0
+#define SIMD_SUB 1
+#define SIMD_MUL 2
+#define SIMD_DIV 3
+#define SIMD_LT 4
+#define SIMD_GT 5
+#define SIMD_LE 6
+#define SIMD_GE 7
+
+// Kernels over arrays of doubles. They use AVX when the compiler targets
+// it, SSE2 on any other x86-64, and plain loops elsewhere; the sums may
+// differ in their last bits from one to the other.
+
+// The width in doubles of the kernels compiled in: 4, 2 or 1.
+std::size_t simd_width();
+
+// out[i] = x[i] op y[i] for every i < n. A step of 0 instead of 1 uses
+// the single x or y for every element. out may be x or y.
+void simd_binary(unsigned op, const double *x, std::size_t x_step,
+                 const double *y, std::size_t y_step, double *out, std::size_t n);
+
+double simd_sum(const double *x, std::size_t n);
+double simd_dot(const double *x, const double *y, std::size_t n);
+// Of n >= 1 elements.
+double simd_min(const double *x, std::size_t n);
+double simd_max(const double *x, std::size_t n);
+
+#endif
@@ -1,5 +1,8 @@
 #include "Symbol.hpp"
 
+#include <cstring>
+#include <initializer_list>
+
 Symbol::Symbol(): id() {}
 
 Symbol::Symbol(unsigned long _id): id(_id) {}
@@ -16,25 +19,48 @@ bool Symbol::operator!=(const Symbol &s) const {
     return id != s.id;
 }
 
-Symbol_table::Symbol_table(): by_name(), by_id() {}
+Symbol_table::Symbol_table()
+    : by_name(), by_id(), chunks(), free_space(nullptr), free_size(0) {
+    // In the order of the SYMBOL_* ids.
+    for (const char *name : {"at", "freq", "dur", "amp"})
+        intern(name);
+}
 
-Symbol Symbol_table::intern(const std::string &s) {
-    auto iter = by_name.find(s);
-    if (iter != by_name.end()) {
+Symbol Symbol_table::intern(std::string_view name) {
+    auto iter = by_name.find(name);
+    if (iter != by_name.end())
         return iter->second;
-    } else {
-        unsigned long id = by_id.size();
-        by_id.push_back(s);
-        Symbol sym(id);
-        by_name.emplace(std::make_pair(s, sym));
-        return sym;
-    }
+    std::string_view stored = store(name);
+    Symbol sym(by_id.size());
+    by_id.push_back(stored);
+    by_name.emplace(stored, sym);
+    return sym;
 }
 
-std::string Symbol_table::symbol_string(const Symbol &s) {
+std::string_view Symbol_table::symbol_string(const Symbol &s) const {
     return by_id.at(s.id);
 }
 
+std::string_view Symbol_table::store(std::string_view name) {
+    if (name.empty())
+        return std::string_view();
+    if (name.size() > free_size) {
+        std::size_t size = name.size() > CHUNK ? name.size() : CHUNK;
+        chunks.emplace_back(new char[size]);
+        free_space = chunks.back().get();
+        free_size = size;
+    }
+    char *p = free_space;
+    std::memcpy(p, name.data(), name.size());
+    free_space += name.size();
+    free_size -= name.size();
+    return std::string_view(p, name.size());
+}
+
+std::size_t Symbol_table::size() const {
+    return by_id.size();
+}
+
 std::size_t Symbol_hash::operator()(const Symbol &s) const {
     return s.hash();
 }
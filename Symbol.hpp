@@ -1,8 +1,19 @@
 #ifndef SYMBOL_HPP_INCLUDED
 #define SYMBOL_HPP_INCLUDED
 
-#include <vector>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+// Symbols every Symbol_table starts with, so that built-ins can refer to
+// them without interning.
+#define SYMBOL_AT 0
+#define SYMBOL_FREQ 1
+#define SYMBOL_DUR 2
+#define SYMBOL_AMP 3
 
 class Symbol {
 public:
@@ -16,16 +27,27 @@ public:
     unsigned long id;
 };
 
+// Names are stored once, in an append-only arena that never moves them,
+// and both the lookup map and by_id hold views into it.
 class Symbol_table {
 public:
     Symbol_table();
 
-    Symbol intern(const std::string &s);
-    std::string symbol_string(const Symbol &s);
+    Symbol intern(std::string_view name);
+    // The view stays valid for the life of the table.
+    std::string_view symbol_string(const Symbol &s) const;
+    std::size_t size() const;
 
 private:
-    std::unordered_map<std::string, Symbol> by_name;
-    std::vector<std::string> by_id;
+    static constexpr std::size_t CHUNK = 4096;
+
+    std::unordered_map<std::string_view, Symbol> by_name;
+    std::vector<std::string_view> by_id;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char *free_space;
+    std::size_t free_size;
+
+    std::string_view store(std::string_view name);
 };
 
 struct Symbol_hash {
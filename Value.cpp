@@ -1,51 +1,125 @@
 #include "Value.hpp"
+#include "Built_ins.hpp"
+#include "Bytecode.hpp"
 #include "Interpreter.hpp"
+#include "Pool.hpp"
+#include "Shape.hpp"
 
-struct Built_in {
-    Symbol name;
-    unsigned args;
-    Native_f func;
-
-    Built_in(Symbol _name, unsigned _args, Native_f _f)
-        : name(_name), args(_args), func(_f) {}
-};
-
-struct Block_t {
-    unsigned long refcount;
-    Symbol *name;
-    std::vector<Instr> code;
-
-    Block_t(Symbol *_name, std::vector<Instr> _code)
-        : refcount(0), name(_name), code(_code) {}
-};
+#include <atomic>
 
+// Fields keyed by symbols live in slots, in the order of the keys of
+// shape, for as long as they fit. After that shape is nullptr and every
+// field is in fields.
 struct Object {
     unsigned long refcount;
+    const Shape *shape;
     Value::Field_map fields;
+    Value slots[SHAPE_MAX_SLOTS];
+
+    Object(): refcount(0), shape(Shape::empty()), fields(), slots() {}
+    Object(const Object &other): refcount(0), shape(other.shape), fields(other.fields), slots() {
+        if (shape != nullptr) {
+            for (unsigned i = 0; i < shape->size(); ++i)
+                slots[i] = other.slots[i];
+        }
+    }
+
+    std::size_t size() const {
+        return shape == nullptr ? fields.size() : shape->size();
+    }
+
+    const Value *find(const Value &key) const;
+    void set(Value key, Value v);
+    bool erase(const Value &key);
+    // Moves the slots into fields for good.
+    void to_map();
 
-    Object():refcount(0), fields() {}
-    Object(Value::Field_map map): refcount(0), fields(std::move(map)) {}
+    static void *operator new(std::size_t size) { return pool_alloc(size); }
+    static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
 };
 
+const Value *Object::find(const Value &key) const {
+    if (shape == nullptr)
+        return fields.find(key);
+    if (key.tag() != VALUE_SYMBOL)
+        return nullptr;
+    int i = shape->slot(key.asSymbol());
+    return i < 0 ? nullptr : &slots[i];
+}
+
+void Object::set(Value key, Value v) {
+    if (shape != nullptr && key.tag() == VALUE_SYMBOL) {
+        Symbol k = key.asSymbol();
+        int i = shape->slot(k);
+        if (i >= 0) {
+            slots[i] = std::move(v);
+            return;
+        }
+        const Shape *next = shape->with(k);
+        if (next != nullptr) {
+            slots[shape->size()] = std::move(v);
+            shape = next;
+            return;
+        }
+    }
+    if (shape != nullptr)
+        to_map();
+    fields.set(std::move(key), std::move(v));
+}
+
+bool Object::erase(const Value &key) {
+    if (shape == nullptr)
+        return fields.erase(key);
+    if (key.tag() != VALUE_SYMBOL)
+        return false;
+    int gone = shape->slot(key.asSymbol());
+    if (gone < 0)
+        return false;
+    // The shape of the remaining keys in their old order.
+    const Shape *next = Shape::empty();
+    for (unsigned i = 0; i < shape->size() && next != nullptr; ++i) {
+        if (static_cast<int>(i) != gone)
+            next = next->with(shape->key(i));
+    }
+    if (next == nullptr) {
+        to_map();
+        return fields.erase(key);
+    }
+    for (unsigned i = gone; i + 1 < shape->size(); ++i)
+        slots[i] = std::move(slots[i + 1]);
+    slots[shape->size() - 1] = Value::nil();
+    shape = next;
+    return true;
+}
+
+void Object::to_map() {
+    for (unsigned i = 0; i < shape->size(); ++i) {
+        fields.set(Value::fromSymbol(shape->key(i)), std::move(slots[i]));
+        slots[i] = Value::nil();
+    }
+    shape = nullptr;
+}
+
 struct Array {
-    std::vector<Value> elems;
+    Value::Elems elems;
     unsigned long refcount;
 
     Array():elems(), refcount(0) {}
-    Array(std::vector<Value> _elems): elems(std::move(_elems)), refcount(0) {}
+    Array(Value::Elems _elems): elems(std::move(_elems)), refcount(0) {}
+
+    static void *operator new(std::size_t size) { return pool_alloc(size); }
+    static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
 };
 
-std::size_t Value::tag() const {
-    return var.index();
-}
+struct Packed {
+    unsigned long refcount;
+    std::vector<double> elems;
 
-Value Value::nil() {
-    return Value();
-}
+    Packed(std::vector<double> _elems): refcount(0), elems(std::move(_elems)) {}
 
-Value Value::fromDouble(double d) {
-    return Value(d);
-}
+    static void *operator new(std::size_t size) { return pool_alloc(size); }
+    static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
+};
 
 Value Value::fromSymbol(Symbol s) {
     return Value(s);
@@ -55,136 +129,303 @@ Value Value::object() {
     return Value(new Object);
 }
 
-Value Value::from_map(Value::Field_map map) {
-    return Value(new Object(std::move(map)));
-}
-
 Value Value::array() {
     return Value(new Array);
 }
 
-Value Value::from_vector(std::vector<Value> vec) {
+Value Value::from_vector(Value::Elems vec) {
     return Value(new Array(std::move(vec)));
 }
 
+Value Value::packed(std::vector<double> elems) {
+    return Value(new Packed(std::move(elems)));
+}
+
 Value Value::func(Symbol *s, std::vector<Instr> code) {
-    return Value(new Block_t(s, code));
+    return Value(new Block_t(s, std::move(code)));
 }
 
-Value Value::built_in(Symbol s, unsigned args, Native_f f) {
-    return Value(new Built_in(s, args, f));
+Value Value::built_in(const Built_in *b) {
+    return Value(b);
 }
 
 const Symbol* Value::funcName() const {
     switch (tag()) {
     case VALUE_DEFINED:
-        return std::get<VALUE_DEFINED>(var)->name;
-    case VALUE_BUILT_IN:
-        return &std::get<VALUE_BUILT_IN>(var)->name;
+        return asBlock()->name;
     default:
         throw "funcName illegal argument";
     }
 }
 
-double Value::asDouble() const {
-    return std::get<VALUE_NUMBER>(var);
-}
-
 Symbol Value::asSymbol() const {
-    return std::get<VALUE_SYMBOL>(var);
+    return Symbol(bits & PAYLOAD);
 }
 
 std::vector<Instr>& Value::definedFunc() {
-    return std::get<VALUE_DEFINED>(var)->code;
+    return asBlock()->code;
+}
+
+const Built_in *Value::asBuiltIn() const {
+    return static_cast<const Built_in *>(pointer());
+}
+
+Block_t *Value::asBlock() const {
+    return static_cast<Block_t *>(pointer());
+}
+
+Value::Elems &Value::array_elems() {
+    return static_cast<Array *>(pointer())->elems;
+}
+
+const Value::Elems &Value::array_elems() const {
+    return static_cast<const Array *>(pointer())->elems;
 }
 
-unsigned Value::nativeFuncArgs() const {
-    return std::get<VALUE_BUILT_IN>(var)->args;
+const Value *Value::field(const Value &key) const {
+    return static_cast<const Object *>(pointer())->find(key);
 }
 
-Native_f Value::nativeFunc() const {
-    return std::get<VALUE_BUILT_IN>(var)->func;
+void Value::set_field(Value key, Value v) {
+    static_cast<Object *>(pointer())->set(std::move(key), std::move(v));
 }
 
-std::vector<Value> &Value::array_elems() {
-    return std::get<VALUE_ARRAY>(var)->elems;
+bool Value::erase_field(const Value &key) {
+    return static_cast<Object *>(pointer())->erase(key);
 }
 
-const std::vector<Value> &Value::array_elems() const {
-    return std::get<VALUE_ARRAY>(var)->elems;
+std::size_t Value::field_count() const {
+    return static_cast<const Object *>(pointer())->size();
 }
 
-Value::Field_map &Value::obj_fields() {
-    return std::get<VALUE_OBJECT>(var)->fields;
+void Value::for_each_field(const std::function<void(const Value &, const Value &)> &f) const {
+    const Object *o = static_cast<const Object *>(pointer());
+    if (o->shape == nullptr) {
+        o->fields.for_each(f);
+        return;
+    }
+    for (unsigned i = 0; i < o->shape->size(); ++i)
+        f(Value::fromSymbol(o->shape->key(i)), o->slots[i]);
 }
 
-const Value::Field_map &Value::obj_fields() const {
-    return std::get<VALUE_OBJECT>(var)->fields;
+std::vector<double> &Value::packed_elems() {
+    return static_cast<Packed *>(pointer())->elems;
 }
 
-Value::Value(): var() {}
+const std::vector<double> &Value::packed_elems() const {
+    return static_cast<const Packed *>(pointer())->elems;
+}
 
-Value::Value(double d): var(d) {}
+const void *Value::cell() const {
+    return pointer();
+}
 
-Value::Value(Symbol s): var(s) {}
+bool Value::unique() const {
+    switch (tag()) {
+    case VALUE_DEFINED:
+        return asBlock()->refcount == 1;
+    case VALUE_OBJECT:
+        return static_cast<Object *>(pointer())->refcount == 1;
+    case VALUE_ARRAY:
+        return static_cast<Array *>(pointer())->refcount == 1;
+    case VALUE_PACKED:
+        return static_cast<Packed *>(pointer())->refcount == 1;
+    default:
+        return false;
+    }
+}
 
-Value::Value(Built_in *p): var(p) {}
+void Value::unshare() {
+    switch (tag()) {
+    case VALUE_OBJECT:
+        if (!unique())
+            *this = Value(new Object(*static_cast<Object *>(pointer())));
+        break;
+    case VALUE_ARRAY:
+        if (!unique())
+            *this = from_vector(array_elems());
+        break;
+    case VALUE_PACKED:
+        if (!unique())
+            *this = packed(packed_elems());
+        break;
+    }
+}
 
-Value::Value(Block_t *p): var(std::in_place_index<VALUE_DEFINED>, boost::intrusive_ptr(p, true)) {}
+Value::Value(Symbol s): bits(BOX | (std::uint64_t(VALUE_SYMBOL) << 48) | (s.id & PAYLOAD)) {}
 
-Value::Value(Object *p): var(std::in_place_index<VALUE_OBJECT>, boost::intrusive_ptr(p, true)) {}
+Value::Value(std::size_t tag, const void *p)
+    : bits(BOX | (std::uint64_t(tag) << 48) | (reinterpret_cast<std::uintptr_t>(p) & PAYLOAD)) {}
 
-Value::Value(Array *p): var(std::in_place_index<VALUE_ARRAY>, boost::intrusive_ptr(p, true)) {}
+Value::Value(const Built_in *p): Value(VALUE_BUILT_IN, p) {}
 
+Value::Value(Block_t *p): Value(VALUE_DEFINED, p) {
+    intrusive_ptr_add_ref(p);
+}
 
-std::size_t Value::hash() const {
+Value::Value(Object *p): Value(VALUE_OBJECT, p) {
+    intrusive_ptr_add_ref(p);
+}
+
+Value::Value(Array *p): Value(VALUE_ARRAY, p) {
+    intrusive_ptr_add_ref(p);
+}
+
+Value::Value(Packed *p): Value(VALUE_PACKED, p) {
+    intrusive_ptr_add_ref(p);
+}
+
+void *Value::pointer() const {
+    return reinterpret_cast<void *>(static_cast<std::uintptr_t>(bits & PAYLOAD));
+}
+
+void Value::retain() const {
     switch (tag()) {
-    case VALUE_NIL:
-        return 0;
-    case VALUE_NUMBER:
-        return static_cast<std::size_t>(asDouble());
-    case VALUE_SYMBOL:
-        return asSymbol().hash();
-    case VALUE_BUILT_IN:
-        return reinterpret_cast<std::size_t>(std::get<VALUE_BUILT_IN>(var));
     case VALUE_DEFINED:
-        return reinterpret_cast<std::size_t>(std::get<VALUE_DEFINED>(var).get());
+        intrusive_ptr_add_ref(static_cast<Block_t *>(pointer()));
+        break;
+    case VALUE_OBJECT:
+        intrusive_ptr_add_ref(static_cast<Object *>(pointer()));
+        break;
     case VALUE_ARRAY:
-        return reinterpret_cast<std::size_t>(std::get<VALUE_ARRAY>(var).get());
+        intrusive_ptr_add_ref(static_cast<Array *>(pointer()));
+        break;
+    case VALUE_PACKED:
+        intrusive_ptr_add_ref(static_cast<Packed *>(pointer()));
+        break;
+    }
+}
+
+void Value::release() const {
+    switch (tag()) {
+    case VALUE_DEFINED:
+        intrusive_ptr_release(static_cast<Block_t *>(pointer()));
+        break;
     case VALUE_OBJECT:
-        return reinterpret_cast<std::size_t>(std::get<VALUE_OBJECT>(var).get());
-    default:
-        throw -1;
+        intrusive_ptr_release(static_cast<Object *>(pointer()));
+        break;
+    case VALUE_ARRAY:
+        intrusive_ptr_release(static_cast<Array *>(pointer()));
+        break;
+    case VALUE_PACKED:
+        intrusive_ptr_release(static_cast<Packed *>(pointer()));
+        break;
     }
 }
 
-bool Value::operator==(const Value &other) const {
-    if (tag() != other.tag())
-        return false;
+// The finalizer of SplitMix64. Every bit of x affects every bit of the
+// result, so even doubles of small integers, which differ only in their
+// top bits, and aligned pointers spread over the low bits that a Hamt
+// indexes by first.
+static std::size_t mix(std::uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+    return static_cast<std::size_t>(x ^ (x >> 31));
+}
+
+std::size_t Value::hash() const {
     switch (tag()) {
     case VALUE_NIL:
-        return true;
+        return 0;
     case VALUE_NUMBER:
-        return asDouble() == other.asDouble();
+        // 0 and -0 are equal, so they have to hash alike.
+        return mix(asDouble() == 0 ? 0 : bits);
     case VALUE_SYMBOL:
-        return asSymbol() == other.asSymbol();
+        return asSymbol().hash();
     case VALUE_BUILT_IN:
-        return std::get<VALUE_BUILT_IN>(var) == std::get<VALUE_BUILT_IN>(other.var);
     case VALUE_DEFINED:
-        return std::get<VALUE_DEFINED>(var) == std::get<VALUE_DEFINED>(other.var);
     case VALUE_ARRAY:
-        return std::get<VALUE_ARRAY>(var) == std::get<VALUE_ARRAY>(other.var);
     case VALUE_OBJECT:
-        return std::get<VALUE_OBJECT>(var) == std::get<VALUE_OBJECT>(other.var);
+    case VALUE_PACKED:
+        return mix(bits);
     default:
         throw -1;
     }
 }
 
+bool Value::operator==(const Value &other) const {
+    // Boxed values are equal when their words are; numbers compare as
+    // doubles so that 0 = -0 and NaN /= NaN.
+    if (bits < BOX && other.bits < BOX)
+        return asDouble() == other.asDouble();
+    return bits == other.bits;
+}
+
 bool Value::operator!=(const Value &other) const {
     return !(*this == other);
 }
 
+// A cell whose last reference is gone, waiting for reclaim_deferred. It
+// keeps its refcount of 1.
+struct Deferred {
+    Deferred *next;
+    std::size_t tag;
+    void *cell;
+
+    static void *operator new(std::size_t size) { return pool_alloc(size); }
+    static void operator delete(void *p, std::size_t size) { pool_free(p, size); }
+};
+
+static std::atomic<std::size_t> free_min(0);
+// A Treiber stack that any thread may push onto. The reclaiming thread
+// takes all of it at once, so it never pops a node that could be pushed
+// back in the meantime.
+static std::atomic<Deferred *> deferred(nullptr);
+// Taken from deferred and only seen by the reclaiming thread.
+static Deferred *reclaiming = nullptr;
+
+// Whether freeing the cell could take long: it is big, and enough of it is
+// not shared with live values, which would only lose a reference.
+static bool deferrable(const Array *p) {
+    std::size_t min = free_min.load(std::memory_order_relaxed);
+    return min != 0 && p->elems.size() >= min && p->elems.owned(min) >= min;
+}
+
+static bool deferrable(const Object *p) {
+    std::size_t min = free_min.load(std::memory_order_relaxed);
+    return min != 0 && p->shape == nullptr && p->fields.size() >= min
+        && p->fields.owned(min) >= min;
+}
+
+static void defer(std::size_t tag, void *cell) {
+    Deferred *d = new Deferred{deferred.load(std::memory_order_relaxed), tag, cell};
+    while (!deferred.compare_exchange_weak(d->next, d, std::memory_order_release,
+                                           std::memory_order_relaxed)) {}
+}
+
+void set_deferred_free_min(std::size_t min) {
+    free_min.store(min, std::memory_order_relaxed);
+}
+
+// Takes the cell's elements apart a slice at a time, so that a huge one
+// can be reclaimed over several calls. Returns whether it is now empty.
+static bool empty_cell(const Deferred &d, std::size_t &budget) {
+    if (d.tag == VALUE_ARRAY)
+        return static_cast<Array *>(d.cell)->elems.release_some(budget);
+    // Only fields can be large; the few slots go with the cell.
+    return static_cast<Object *>(d.cell)->fields.release_some(budget);
+}
+
+bool reclaim_deferred(std::size_t budget) {
+    while (budget > 0) {
+        if (reclaiming == nullptr) {
+            reclaiming = deferred.exchange(nullptr, std::memory_order_acquire);
+            if (reclaiming == nullptr)
+                return false;
+        }
+        Deferred *d = reclaiming;
+        if (!empty_cell(*d, budget))
+            return true;
+        if (d->tag == VALUE_ARRAY)
+            delete static_cast<Array *>(d->cell);
+        else
+            delete static_cast<Object *>(d->cell);
+        reclaiming = d->next;
+        delete d;
+    }
+    return reclaiming != nullptr || deferred.load(std::memory_order_relaxed) != nullptr;
+}
+
 void intrusive_ptr_add_ref(Block_t *p) {
     ++p->refcount;
 }
@@ -201,10 +442,12 @@ void intrusive_ptr_add_ref(Object *p) {
 }
 
 void intrusive_ptr_release(Object *p) {
-    if (p->refcount == 1)
-        delete p;
-    else
+    if (p->refcount != 1)
         --p->refcount;
+    else if (deferrable(p))
+        defer(VALUE_OBJECT, p);
+    else
+        delete p;
 }
 
 void intrusive_ptr_add_ref(Array *p) {
@@ -212,9 +455,21 @@ void intrusive_ptr_add_ref(Array *p) {
 }
 
 void intrusive_ptr_release(Array *p) {
+    if (p->refcount != 1)
+        --p->refcount;
+    else if (deferrable(p))
+        defer(VALUE_ARRAY, p);
+    else
+        delete p;
+}
+
+void intrusive_ptr_add_ref(Packed *p) {
+    ++p->refcount;
+}
+
+void intrusive_ptr_release(Packed *p) {
     if (p->refcount == 1)
         delete p;
     else
         --p->refcount;
 }
-
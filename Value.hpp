@@ -1,11 +1,13 @@
 #ifndef VALUE_HPP_INCLUDED
 #define VALUE_HPP_INCLUDED
 
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <string>
-#include <variant>
 #include <vector>
-#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include "Hamt.hpp"
+#include "Persistent_vector.hpp"
 #include "Symbol.hpp"
 
 #define VALUE_NIL 0
@@ -15,6 +17,8 @@
 #define VALUE_DEFINED 4
 #define VALUE_OBJECT 5
 #define VALUE_ARRAY 6
+// An array of numbers stored unboxed, for the SIMD kernels.
+#define VALUE_PACKED 7
 
 class Interpreter;
 
@@ -22,8 +26,7 @@ struct Built_in;
 struct Block_t;
 struct Object;
 struct Array;
-
-using Native_f = std::function<void(Interpreter&)>;
+struct Packed;
 
 template <class T>
 struct Instruction {
@@ -35,17 +38,18 @@ struct Instruction {
 
 class Value {
 public:
-    using Field_map = std::unordered_map<Value, Value>;
+    using Field_map = Hamt<Value, Value>;
+    using Elems = Persistent_vector<Value>;
 
     static Value nil();
     static Value fromDouble(double d);
     static Value fromSymbol(Symbol s);
     static Value func(Symbol *name, std::vector<Instruction<Value>> code);
-    static Value built_in(Symbol name, unsigned args, Native_f f);
+    static Value built_in(const Built_in *b);
     static Value object();
     static Value array();
-    static Value from_vector(std::vector<Value> vec);
-    static Value from_map(Field_map map);
+    static Value from_vector(Elems vec);
+    static Value packed(std::vector<double> elems);
 
     std::size_t tag() const;
 
@@ -53,41 +57,157 @@ public:
     Symbol asSymbol() const;
     const Symbol *funcName() const;
     std::vector<Instruction<Value>>& definedFunc();
-    unsigned nativeFuncArgs() const;
-    Native_f nativeFunc() const;
-    std::vector<Value> &array_elems();
-    const std::vector<Value> &array_elems() const;
-    Field_map &obj_fields();
-    const Field_map &obj_fields() const;
+    const Built_in *asBuiltIn() const;
+    Block_t *asBlock() const;
+    Elems &array_elems();
+    const Elems &array_elems() const;
+    // Fields of an object. Setting and erasing change the object in place,
+    // so unshare() it first.
+    const Value *field(const Value &key) const;
+    void set_field(Value key, Value v);
+    bool erase_field(const Value &key);
+    std::size_t field_count() const;
+    // Calls f with the key and value of every field, in the order they
+    // were added as long as the object has kept a shape.
+    void for_each_field(const std::function<void(const Value &, const Value &)> &f) const;
+    std::vector<double> &packed_elems();
+    const std::vector<double> &packed_elems() const;
+
+    // The heap cell of a refcounted value, which tells cells apart.
+    const void *cell() const;
+    // Whether this is the only reference to its heap cell.
+    bool unique() const;
+    // Gives this value its own array, packed array or object cell, so that the contents
+    // can be updated in place. The cell is copied only when it is shared,
+    // and the copy shares its elements persistently with the original.
+    void unshare();
 
     std::size_t hash() const;
     bool operator==(const Value &other) const;
     bool operator!=(const Value &other) const;
 
+    Value(const Value &other);
+    Value(Value &&other) noexcept;
+    Value &operator=(const Value &other);
+    Value &operator=(Value &&other) noexcept;
+    ~Value();
+
 private:
+    // For its array of slots.
+    friend struct Object;
+
+    // Values are NaN-boxed into a single word. Numbers are stored as their
+    // IEEE-754 bits, with NaNs canonicalized to a positive quiet NaN. Every
+    // other value lives in the negative quiet NaN space: the top 13 bits are
+    // set, bits 48-50 hold the VALUE_* tag and the low 48 bits hold a symbol
+    // id or a pointer. Tags from VALUE_DEFINED up are refcounted heap cells.
+    static constexpr std::uint64_t BOX = 0xFFF8000000000000;
+    static constexpr std::uint64_t PAYLOAD = 0x0000FFFFFFFFFFFF;
+    static constexpr std::uint64_t CANONICAL_NAN = 0x7FF8000000000000;
+    static constexpr std::uint64_t HEAP = BOX | (std::uint64_t(VALUE_DEFINED) << 48);
+
     Value();
     Value(double d);
     Value(Symbol s);
-    Value(Built_in *p);
+    Value(const Built_in *p);
     Value(Block_t *p);
     Value(Object *p);
     Value(Array *p);
-    std::variant<
-        std::monostate,
-        double, Symbol, Built_in*,
-        boost::intrusive_ptr<Block_t>,
-        boost::intrusive_ptr<Object>,
-        boost::intrusive_ptr<Array>> var;
+    Value(Packed *p);
+    Value(std::size_t tag, const void *p);
+
+    bool is_heap() const;
+    void *pointer() const;
+    void retain() const;
+    void release() const;
+
+    std::uint64_t bits;
 };
 
 using Instr = Instruction<Value>;
 
+inline std::size_t Value::tag() const {
+    return bits < BOX ? VALUE_NUMBER : (bits >> 48) & 7;
+}
+
+inline Value::Value(): bits(BOX) {}
+
+inline Value Value::nil() {
+    return Value();
+}
+
+inline double Value::asDouble() const {
+    double d;
+    std::memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+inline Value Value::fromDouble(double d) {
+    return Value(d);
+}
+
+inline Value::Value(double d) {
+    if (d != d)
+        bits = CANONICAL_NAN;
+    else
+        std::memcpy(&bits, &d, sizeof bits);
+}
+
+inline bool Value::is_heap() const {
+    return bits >= HEAP;
+}
+
+inline Value::Value(const Value &other): bits(other.bits) {
+    if (is_heap())
+        retain();
+}
+
+inline Value::Value(Value &&other) noexcept: bits(other.bits) {
+    other.bits = BOX;
+}
+
+inline Value &Value::operator=(const Value &other) {
+    if (other.is_heap())
+        other.retain();
+    if (is_heap())
+        release();
+    bits = other.bits;
+    return *this;
+}
+
+inline Value &Value::operator=(Value &&other) noexcept {
+    if (this != &other) {
+        if (is_heap())
+            release();
+        bits = other.bits;
+        other.bits = BOX;
+    }
+    return *this;
+}
+
+inline Value::~Value() {
+    if (is_heap())
+        release();
+}
+
 void intrusive_ptr_add_ref(Block_t *p);
 void intrusive_ptr_release(Block_t *p);
 void intrusive_ptr_add_ref(Array *p);
 void intrusive_ptr_release(Array *p);
 void intrusive_ptr_add_ref(Object *p);
 void intrusive_ptr_release(Object *p);
+void intrusive_ptr_add_ref(Packed *p);
+void intrusive_ptr_release(Packed *p);
+
+// Dropping the last reference to an array or object of min elements or
+// more only queues its cell, for reclaim_deferred to destroy later. With
+// min 0, the default, every cell is destroyed at once. Cells may be queued
+// on any thread.
+void set_deferred_free_min(std::size_t min);
+// Destroys queued cells until about budget of the values they hold have
+// been released, and returns whether any are left. Only one thread may
+// call it, since the refcounts of those values are not atomic.
+bool reclaim_deferred(std::size_t budget);
 
 namespace std {
     template<>
@@ -0,0 +1,82 @@
+#include "Wakeup.hpp"
+
+#include <chrono>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Wakeup::Wakeup()
+    : epoch(0), waiters(0), notified_at(0), latencies() {}
+
+std::uint32_t Wakeup::prepare() const {
+    return epoch.load();
+}
+
+void Wakeup::wait(std::uint32_t ticket) {
+    bool slept = false;
+    waiters.fetch_add(1);
+#ifdef __linux__
+    while (epoch.load() == ticket) {
+        if (syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch),
+                    FUTEX_WAIT_PRIVATE, ticket, nullptr, nullptr, 0) == 0)
+            slept = true;
+    }
+#else
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (epoch.load() == ticket) {
+            cond.wait(lock);
+            slept = true;
+        }
+    }
+#endif
+    waiters.fetch_sub(1);
+
+    // Only wake-ups that went through the kernel have a meaningful stamp.
+    if (slept) {
+        std::int64_t latency = now_ns() - notified_at.load();
+        if (latency >= 0)
+            latencies.record(latency);
+    }
+}
+
+void Wakeup::notify() {
+    epoch.fetch_add(1);
+    if (waiters.load() != 0) {
+        notified_at.store(now_ns());
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lock(mutex);
+        cond.notify_one();
+#endif
+    }
+}
+
+void Wakeup::notify_all() {
+    epoch.fetch_add(1);
+    if (waiters.load() != 0) {
+        notified_at.store(now_ns());
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch),
+                FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lock(mutex);
+        cond.notify_all();
+#endif
+    }
+}
+
+Histogram &Wakeup::latency() {
+    return latencies;
+}
@@ -0,0 +1,47 @@
+#ifndef WAKEUP_HPP_INCLUDED
+#define WAKEUP_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include "Histogram.hpp"
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// Lets a thread sleep until another hands it work. The waiter takes a
+// ticket with prepare(), checks for work and, if there was none, calls
+// wait(ticket); the other side calls notify() after making work available.
+// A notify that happens after prepare() makes the wait return immediately,
+// so no wake-up is lost. Any number of threads may wait at once, and each
+// notify wakes one of them. The kernel is only entered when a waiter is
+// really parked.
+class Wakeup {
+public:
+    Wakeup();
+
+    std::uint32_t prepare() const;
+    void wait(std::uint32_t ticket);
+    void notify();
+    // Wakes every waiter.
+    void notify_all();
+
+    // Time from a notify() to the parked consumer running again, in
+    // nanoseconds. Only wake-ups that went through the kernel are recorded.
+    Histogram &latency();
+
+private:
+    std::atomic<std::uint32_t> epoch;
+    std::atomic<std::uint32_t> waiters;
+    std::atomic<std::int64_t> notified_at;
+
+    Histogram latencies;
+
+#ifndef __linux__
+    std::mutex mutex;
+    std::condition_variable cond;
+#endif
+};
+
+#endif
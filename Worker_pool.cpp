@@ -0,0 +1,65 @@
+#include "Worker_pool.hpp"
+
+Worker_pool::Worker_pool(std::size_t workers)
+    : threads(), mutex(), start(), done(), stopping(false), generation(0), busy(0),
+      task(nullptr), size_(0), chunk_size(1), next(0) {
+    for (std::size_t i = 1; i < workers; ++i)
+        threads.emplace_back(&Worker_pool::work, this, i);
+}
+
+Worker_pool::~Worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+std::size_t Worker_pool::size() const {
+    return threads.size() + 1;
+}
+
+void Worker_pool::run(std::size_t n, std::size_t chunk, const Task &t) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &t;
+        size_ = n;
+        chunk_size = chunk == 0 ? 1 : chunk;
+        next.store(0, std::memory_order_relaxed);
+        busy = threads.size();
+        ++generation;
+    }
+    start.notify_all();
+    take_chunks(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busy == 0; });
+    task = nullptr;
+}
+
+void Worker_pool::work(std::size_t worker) {
+    std::uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        start.wait(lock, [this, seen]() { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        lock.unlock();
+        take_chunks(worker);
+        lock.lock();
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void Worker_pool::take_chunks(std::size_t worker) {
+    for (;;) {
+        std::size_t begin = next.fetch_add(chunk_size, std::memory_order_relaxed);
+        if (begin >= size_)
+            return;
+        std::size_t end = begin + chunk_size < size_ ? begin + chunk_size : size_;
+        (*task)(worker, begin, end);
+    }
+}
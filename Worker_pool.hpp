@@ -0,0 +1,55 @@
+#ifndef WORKER_POOL_HPP_INCLUDED
+#define WORKER_POOL_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that split loops between them. run() hands out
+// chunks of an index range from a shared counter, so faster workers
+// simply take more of them, and the calling thread works as worker 0
+// rather than sitting idle until the others finish.
+class Worker_pool {
+public:
+    // Called with the worker's number and a chunk [begin, end).
+    using Task = std::function<void(std::size_t worker, std::size_t begin, std::size_t end)>;
+
+    // Starts workers - 1 threads.
+    explicit Worker_pool(std::size_t workers);
+    ~Worker_pool();
+
+    Worker_pool(const Worker_pool &) = delete;
+    Worker_pool &operator=(const Worker_pool &) = delete;
+
+    std::size_t size() const;
+
+    // Runs task over [0, n) in chunks of at most chunk indices and returns
+    // once all of them are done. Only one thread may call it at a time.
+    void run(std::size_t n, std::size_t chunk, const Task &task);
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    bool stopping;
+    // Counts the jobs started, so a worker can tell a new one from a
+    // spurious wake-up.
+    std::uint64_t generation;
+    std::size_t busy;
+
+    const Task *task;
+    std::size_t size_;
+    std::size_t chunk_size;
+    std::atomic<std::size_t> next;
+
+    void work(std::size_t worker);
+    void take_chunks(std::size_t worker);
+};
+
+#endif
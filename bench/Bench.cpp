@@ -0,0 +1,31 @@
+#include "Bench.hpp"
+
+#include <atomic>
+#include <iomanip>
+
+static std::atomic<std::uint64_t> sink(0);
+
+Bench::Bench(std::ostream &_out, double _min_seconds, std::vector<std::string> _filters)
+    : out(_out), min_seconds(_min_seconds), filters(std::move(_filters)) {}
+
+bool Bench::enabled(const std::string &name) const {
+    if (filters.empty())
+        return true;
+    for (const std::string &f : filters) {
+        if (name.find(f) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+void Bench::emit(const std::string &name, std::initializer_list<Field> fields) {
+    out << std::setprecision(12) << "{\"bench\":\"" << name << '"';
+    for (const Field &f : fields)
+        out << ",\"" << f.key << "\":" << f.value;
+    out << "}\n";
+    out.flush();
+}
+
+void Bench::keep(std::uint64_t x) {
+    sink.fetch_add(x, std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#ifndef BENCH_HPP_INCLUDED
+#define BENCH_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Times benchmarks and writes one JSON object per line to out, so results
+// can be collected and compared from one commit to the next.
+class Bench {
+public:
+    struct Field {
+        const char *key;
+        double value;
+    };
+
+    Bench(std::ostream &out, double min_seconds, std::vector<std::string> filters);
+
+    // Whether name matches one of the filters given on the command line.
+    bool enabled(const std::string &name) const;
+
+    // Calls f, which performs ops operations, until min_seconds have passed
+    // and reports the mean time per operation.
+    template <class F>
+    void run(const std::string &name, std::uint64_t ops, F f) {
+        if (!enabled(name))
+            return;
+        f();
+        std::uint64_t calls = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed;
+        do {
+            f();
+            ++calls;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed.count() < min_seconds);
+        double total = static_cast<double>(calls * ops);
+        emit(name, { {"ops", total}, {"ns_per_op", elapsed.count() * 1e9 / total} });
+    }
+
+    void emit(const std::string &name, std::initializer_list<Field> fields);
+
+    // Keeps the compiler from optimising away a result.
+    static void keep(std::uint64_t x);
+
+private:
+    std::ostream &out;
+    double min_seconds;
+    std::vector<std::string> filters;
+};
+
+void bench_interpreter(Bench &b);
+void bench_packed(Bench &b);
+void bench_parallel(Bench &b);
+void bench_values(Bench &b);
+void bench_scheduler(Bench &b);
+
+#endif
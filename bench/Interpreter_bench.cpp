@@ -0,0 +1,204 @@
+#include "Bench.hpp"
+#include "Interpreter.hpp"
+
+static Value word(Interpreter &st, const char *name) {
+    return *st.dict.find(st.symtab.intern(name));
+}
+
+void bench_interpreter(Bench &b) {
+    Interpreter st;
+    st.eval("$block [ 1 2 + drop ] ! "
+            "$inc [ 1 + ] ! "
+            "$nested [ inc inc inc inc ] ! "
+            "$swing [ dup * 0.25 * 1 swap - 0.5 + ] ! "
+            "$xs a{} [ , ] 1000 times ! "
+            "$drop-each [ drop ] ! ");
+
+    std::string line = "1 2.5 + drop $sym drop \\ a comment\n [ 3 * ] drop -4e3 block drop";
+    b.run("eval-line", 1, [&]() {
+        st.eval(line);
+    });
+
+    Value block = word(st, "block");
+    b.run("exec-block", 1000, [&]() {
+        for (int i = 0; i < 1000; ++i)
+            st.exec_value(block);
+    });
+
+    Value nested = word(st, "nested");
+    b.run("exec-nested", 1000, [&]() {
+        st.push(Value::fromDouble(0));
+        for (int i = 0; i < 1000; ++i)
+            st.exec_value(nested);
+        st.pop();
+    });
+
+    Value swing = word(st, "swing");
+    b.run("exec-arith", 1000, [&]() {
+        for (int i = 0; i < 1000; ++i) {
+            st.push(Value::fromDouble(i % 4));
+            st.exec_value(swing);
+            st.pop();
+        }
+    });
+
+    // 1000 iterations of a loop written with if and a tail call.
+    st.eval("$loop [ [ ] [ $n $n @ -1 + ! $loop @ exec ] $n @ 0 > if ] ! ");
+    Value loop = word(st, "loop");
+    Value set = word(st, "!");
+    Value n = Value::fromSymbol(st.symtab.intern("n"));
+    b.run("tail-loop", 1000, [&]() {
+        st.push(n);
+        st.push(Value::fromDouble(1000));
+        st.exec_value(set);
+        st.exec_value(loop);
+    });
+
+    Value push = word(st, ",");
+    b.run("array-push", 1000, [&]() {
+        st.push(Value::array());
+        for (int i = 0; i < 1000; ++i) {
+            st.push(Value::fromDouble(i));
+            st.exec_value(push);
+        }
+        st.pop();
+    });
+
+    Value set_index = word(st, "!i");
+    b.run("array-set", 1000, [&]() {
+        st.push(word(st, "xs"));
+        for (int i = 0; i < 1000; ++i) {
+            st.push(Value::fromDouble(i));
+            st.push(Value::fromDouble(-i));
+            st.exec_value(set_index);
+        }
+        st.pop();
+    });
+
+    Value set_field = word(st, "!f");
+    std::vector<Value> keys;
+    for (int i = 0; i < 16; ++i)
+        keys.push_back(Value::fromSymbol(st.symtab.intern("field" + std::to_string(i))));
+    b.run("object-set", 1000, [&]() {
+        st.push(Value::object());
+        for (int i = 0; i < 1000; ++i) {
+            st.push(keys[i % keys.size()]);
+            st.push(Value::fromDouble(i));
+            st.exec_value(set_field);
+        }
+        st.pop();
+    });
+
+    // A note record like the ones beep reads, built and then read back.
+    Value at = Value::fromSymbol(st.symtab.intern("at"));
+    Value freq = Value::fromSymbol(st.symtab.intern("freq"));
+    b.run("record-build", 1000, [&]() {
+        for (int i = 0; i < 1000; ++i) {
+            st.push(Value::object());
+            st.push(at);
+            st.push(Value::fromDouble(i));
+            st.exec_value(set_field);
+            st.push(freq);
+            st.push(Value::fromDouble(440));
+            st.exec_value(set_field);
+            st.pop();
+        }
+    });
+
+    Value get_field = word(st, "@f");
+    st.eval("$note o{} $at 0.5 !f $freq 440 !f $dur 1 !f $amp 0.25 !f ! ");
+    Value note = word(st, "note");
+    b.run("record-get", 1000, [&]() {
+        for (int i = 0; i < 1000; ++i) {
+            st.push(note);
+            st.push(i % 2 == 0 ? at : freq);
+            st.exec_value(get_field);
+            st.pop();
+        }
+    });
+
+    Value map = word(st, "map");
+    Value inc = word(st, "inc");
+    Value xs = word(st, "xs");
+    b.run("map", 1000, [&]() {
+        st.push(inc);
+        st.push(xs);
+        st.exec_value(map);
+        st.pop();
+    });
+
+    Value iter = word(st, "iter");
+    Value drop_each = word(st, "drop-each");
+    b.run("iter", 1000, [&]() {
+        st.push(drop_each);
+        st.push(xs);
+        st.exec_value(iter);
+    });
+}
+
+void bench_packed(Bench &b) {
+    Interpreter st;
+    st.eval("$halve [ 0.5 * ] ! "
+            "$env 1024 range ! "
+            "$env-boxed env unpack ! ");
+
+    Value map = word(st, "map");
+    Value halve = word(st, "halve");
+    Value boxed = word(st, "env-boxed");
+    b.run("envelope-boxed", 1024, [&]() {
+        st.push(halve);
+        st.push(boxed);
+        st.exec_value(map);
+        st.pop();
+    });
+
+    Value env = word(st, "env");
+    b.run("envelope-packed", 1024, [&]() {
+        st.push(env);
+        st.exec_value(halve);
+        st.pop();
+    });
+
+    Value sum = word(st, "sum");
+    b.run("packed-sum", 1024, [&]() {
+        st.push(env);
+        st.exec_value(sum);
+        st.pop();
+    });
+}
+
+// pmap on 1, 2, 4 and 8 threads, against map, to show how it scales.
+void bench_parallel(Bench &b) {
+    const char *setup = "$partial [ dup dup * swap 3 * + 1 + dup * 0.001 * 1 swap / ] ! "
+                        "$freqs 100000 range ! ";
+    {
+        Interpreter st;
+        st.eval(setup);
+        Value map = word(st, "map");
+        Value partial = word(st, "partial");
+        Value freqs = word(st, "freqs");
+        b.run("map-partials", 100000, [&]() {
+            st.push(partial);
+            st.push(freqs);
+            st.exec_value(map);
+            st.pop();
+        });
+    }
+    for (std::size_t threads = 1; threads <= 8; threads *= 2) {
+        std::string name = "pmap-partials-" + std::to_string(threads);
+        if (!b.enabled(name))
+            continue;
+        Interpreter st;
+        st.worker_count = threads;
+        st.eval(setup);
+        Value pmap = word(st, "pmap");
+        Value partial = word(st, "partial");
+        Value freqs = word(st, "freqs");
+        b.run(name, 100000, [&]() {
+            st.push(partial);
+            st.push(freqs);
+            st.exec_value(pmap);
+            st.pop();
+        });
+    }
+}
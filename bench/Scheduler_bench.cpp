@@ -0,0 +1,45 @@
+#include "Bench.hpp"
+#include "Histogram.hpp"
+#include "Scheduler.hpp"
+
+#include <atomic>
+#include <thread>
+
+void bench_scheduler(Bench &b) {
+    const std::size_t events = 10000;
+
+    b.run("schedule", events, [&]() {
+        Scheduler sched([](const Due_callback &) {}, events);
+        for (std::size_t i = 0; i < events; ++i)
+            sched.schedule_callback(nullptr, Symbol(i), 60.0 + (i * 7919 % events) * 1e-3);
+    });
+
+    if (!b.enabled("scheduler-latency"))
+        return;
+
+    // Half the events fire over half a second while the other half stay
+    // pending far in the future, so every firing works against a heap of
+    // thousands of entries.
+    Histogram lateness;
+    std::atomic<std::size_t> fired(0);
+    Scheduler sched([&](const Due_callback &c) {
+        lateness.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    c.fired - c.deadline).count());
+        fired.fetch_add(1);
+    }, 2 * events);
+    std::thread timer([&]() { sched.start(); });
+    for (std::size_t i = 0; i < events; ++i) {
+        sched.schedule_callback(nullptr, Symbol(i), 3600.0);
+        sched.schedule_callback(nullptr, Symbol(i), 0.05 + (i * 7919 % events) * 0.5 / events);
+    }
+    while (fired.load() < events)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sched.stop();
+    timer.join();
+
+    b.emit("scheduler-latency", {
+        {"events", static_cast<double>(lateness.count())},
+        {"p50_ns", static_cast<double>(lateness.percentile(50))},
+        {"p99_ns", static_cast<double>(lateness.percentile(99))},
+        {"max_ns", static_cast<double>(lateness.max())} });
+}
@@ -0,0 +1,162 @@
+#include "Bench.hpp"
+#include "Pool.hpp"
+#include "Symbol.hpp"
+#include "Value.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+void bench_values(Bench &b) {
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i)
+        names.push_back("symbol-" + std::to_string(i));
+
+    Symbol_table symtab;
+    b.run("intern-existing", names.size(), [&]() {
+        for (const std::string &n : names)
+            Bench::keep(symtab.intern(n).id);
+    });
+
+    b.run("intern-new", names.size(), [&]() {
+        Symbol_table fresh;
+        for (const std::string &n : names)
+            Bench::keep(fresh.intern(n).id);
+    });
+
+    std::vector<Value> values;
+    for (int i = 0; i < 1000; ++i) {
+        switch (i % 4) {
+        case 0:
+            values.push_back(Value::fromDouble(i * 0.5));
+            break;
+        case 1:
+            values.push_back(Value::fromDouble(i));
+            break;
+        case 2:
+            values.push_back(Value::fromSymbol(symtab.intern(names[i])));
+            break;
+        default:
+            values.push_back(Value::array());
+            break;
+        }
+    }
+
+    b.run("value-hash", values.size(), [&]() {
+        std::uint64_t h = 0;
+        for (const Value &v : values)
+            h += v.hash();
+        Bench::keep(h);
+    });
+
+    b.run("value-equal", values.size(), [&]() {
+        std::uint64_t n = 0;
+        for (std::size_t i = 0; i < values.size(); ++i)
+            n += values[i] == values[(i * 7) % values.size()];
+        Bench::keep(n);
+    });
+
+    // Builds and frees an array of 40 numbers: the cell, a leaf and a tail.
+    // Once the pool is warm none of it should reach the global heap, which
+    // the second line reports.
+    auto churn = [&]() {
+        for (int i = 0; i < 1000; ++i) {
+            Value::Elems elems;
+            for (int j = 0; j < 40; ++j)
+                elems.push_back(Value::fromDouble(j));
+            Bench::keep(Value::from_vector(std::move(elems)).hash());
+        }
+    };
+    if (b.enabled("array-churn")) {
+        churn();
+        Pool_stats before = pool_stats();
+        b.run("array-churn", 1000, churn);
+        Pool_stats after = pool_stats();
+        double calls = static_cast<double>(after.chunks + after.large - before.chunks - before.large);
+        b.emit("array-churn-heap", { {"heap_calls", calls} });
+    }
+
+    // Drops the last reference to 100k small arrays held in one array,
+    // first destroying it at once, then deferring it and taking it apart
+    // in slices of 512 values as the idle loop does.
+    if (b.enabled("drop-nested")) {
+        using clock = std::chrono::steady_clock;
+        auto build = []() {
+            Value::Elems outer;
+            for (int i = 0; i < 100000; ++i) {
+                Value::Elems inner;
+                for (int j = 0; j < 4; ++j)
+                    inner.push_back(Value::fromDouble(j));
+                outer.push_back(Value::from_vector(std::move(inner)));
+            }
+            return Value::from_vector(std::move(outer));
+        };
+        for (std::size_t min : {std::size_t(0), std::size_t(1024)}) {
+            set_deferred_free_min(min);
+            double drop_ns = 0;
+            double slice_ns = 0;
+            double max_slice_ns = 0;
+            double slices = 0;
+            const int reps = 10;
+            for (int r = 0; r < reps; ++r) {
+                Value v = build();
+                clock::time_point start = clock::now();
+                v = Value::nil();
+                drop_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+                bool more = true;
+                while (more) {
+                    start = clock::now();
+                    more = reclaim_deferred(512);
+                    double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+                    slice_ns += ns;
+                    ++slices;
+                    if (ns > max_slice_ns)
+                        max_slice_ns = ns;
+                }
+            }
+            b.emit(min == 0 ? "drop-nested" : "drop-nested-deferred",
+                   { {"drop_ns", drop_ns / reps}, {"slice_ns", slice_ns / slices},
+                     {"max_slice_ns", max_slice_ns} });
+        }
+        set_deferred_free_min(0);
+    }
+
+    // Drops a copy of a 100k-element array that differs from the live
+    // original in one element, so that it shares all but one path of its
+    // trie. With the usual minimum it owns too little to be deferred; with
+    // a minimum of 1 it is deferred, and reclaiming it releases the shared
+    // nodes whole.
+    if (b.enabled("drop-shared")) {
+        using clock = std::chrono::steady_clock;
+        Value::Elems elems;
+        for (int i = 0; i < 100000; ++i)
+            elems.push_back(Value::fromDouble(i));
+        Value original = Value::from_vector(std::move(elems));
+        for (std::size_t min : {std::size_t(1024), std::size_t(1)}) {
+            set_deferred_free_min(min);
+            double drop_ns = 0;
+            double reclaim_ns = 0;
+            double slices = 0;
+            const int reps = 100;
+            for (int r = 0; r < reps; ++r) {
+                Value copy = original;
+                copy.unshare();
+                copy.array_elems().set(0, Value::fromDouble(-1));
+                clock::time_point start = clock::now();
+                copy = Value::nil();
+                drop_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+                bool more = true;
+                while (more) {
+                    start = clock::now();
+                    more = reclaim_deferred(512);
+                    reclaim_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+                    ++slices;
+                }
+            }
+            b.emit(min == 1 ? "drop-shared-forced" : "drop-shared",
+                   { {"drop_ns", drop_ns / reps}, {"reclaim_ns", reclaim_ns / reps},
+                     {"slices", slices / reps} });
+        }
+        set_deferred_free_min(0);
+    }
+}
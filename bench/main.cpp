@@ -0,0 +1,29 @@
+#include "Bench.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Usage: otj_bench [--min-time SECONDS] [NAME...]
+// Runs every benchmark whose name contains one of the NAMEs, or all of
+// them, and prints one JSON line per result on stdout.
+int main(int argc, char **argv)
+{
+    double min_seconds = 0.2;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            min_seconds = std::stod(argv[++i]);
+        else
+            filters.emplace_back(argv[i]);
+    }
+
+    Bench b(std::cout, min_seconds, filters);
+    bench_interpreter(b);
+    bench_packed(b);
+    bench_parallel(b);
+    bench_values(b);
+    bench_scheduler(b);
+    return 0;
+}
@@ -1,11 +1,14 @@
 #include <atomic>
+#include <chrono>
+#include <cmath>
 #include <csound/csound.hpp>
 #include <iostream>
 #include <string>
 #include <boost/lockfree/spsc_queue.hpp>
 #include <thread>
 
-#include "Built_ins.hpp"
+#include "Image.hpp"
+#include "Pool.hpp"
 #include "Term.hpp"
 #include "Scheduler.hpp"
 #include "Interpreter.hpp"
@@ -17,20 +20,71 @@ const char *orc_text =
 
 const char *sco_text = "i1 0 5 1000 440 \n";
 
-int main()
+// Every note sounds this much after its nominal time, so that it still
+// lands ahead of a Csound that has run ahead to fill its output buffer.
+const double note_latency = 0.05;
+
+// Blocks of every size class set aside before anything runs, so that
+// callbacks take cells from the pool instead of the global heap, which the
+// Csound thread allocates from too.
+const std::size_t pool_reserve_bytes = 1 << 20;
+
+// Arrays and objects this large are freed while the interpreter is idle
+// rather than by whatever callback drops them.
+const std::size_t deferred_min_elems = 1024;
+
+// Hands every waiting note to Csound, starting on the sample frame that
+// matches its time rather than on the next control block. Frame 0 was
+// rendered at epoch.
+static void send_notes(Csound &csd, Interpreter &st, Clock::time_point epoch)
+{
+    MYFLT sr = csd.GetSr();
+    long frame = csd.GetCurrentTimeSamples();
+    st.notes.consume_all([&](Note_event &n) {
+        double t = std::chrono::duration<double>(n.at - epoch).count() + note_latency;
+        double offset = std::round(t * sr) - frame;
+        if (offset < 0)
+            offset = 0;
+        MYFLT p[5] = { n.instr, offset / sr, n.dur, n.amp, n.freq };
+        csd.ScoreEvent('i', p, 5);
+    });
+}
+
+// Usage: otj [-i IMAGE] [SCRIPT...]
+// The image, then each script in order, is loaded before the interactive
+// session starts.
+int main(int argc, char **argv)
 {
     Term t = Term::lit_double(0);
     std::atomic_bool run(true);
+    pool_reserve(pool_reserve_bytes);
+    set_deferred_free_min(deferred_min_elems);
+    Interpreter st;
+    int first_script = 1;
+    if (argc > 2 && std::string(argv[1]) == "-i") {
+        if (!load_image(st, argv[2]))
+            return 1;
+        first_script = 3;
+    }
+    for (int i = first_script; i < argc; ++i) {
+        if (!st.load(argv[i]))
+            return 1;
+    }
+
     Csound csd;
     csd.SetOption("-odac");
+    csd.SetOption("--sample-accurate");
     csd.Start();
     csd.CompileOrc(orc_text);
-    std::thread csd_thread([&run, &csd]() {
+    std::thread csd_thread([&run, &csd, &st]() {
+        Clock::time_point epoch = std::chrono::steady_clock::now();
         while (run.load()) {
+            send_notes(csd, st, epoch);
             int result = csd.PerformKsmps();
             if (result != 0) {
                 std::cerr << "csound error\n";
                 run.store(false);
+                st.wake();
                 break;
             }
         }
@@ -38,21 +92,23 @@ int main()
         csd.Cleanup();
     });
 
-    Interpreter st;
-    load_built_ins(st);
-
     std::thread inp_thread = std::thread([&csd, &run, &st](){
-        std::string tok;
-        while (run.load() && std::cin >> tok) {
-            if (tok == "#quit") {
+        std::string line;
+        while (run.load() && std::getline(std::cin, line)) {
+            if (line == "#quit") {
                 break;
             }
-            st.read(tok);
+            st.read(line);
         }
         run.store(false);
+        st.wake();
     });
 
     st.start(run);
 
+    csd_thread.join();
+    // The input thread may still be blocked reading stdin.
+    inp_thread.detach();
+
     return 0;
 }
@@ -0,0 +1,78 @@
+// Quitting must not hang when the scheduler thread is parked on a full
+// QUEUE_BLOCK callback queue.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <thread>
+
+#include "Built_ins.hpp"
+#include "Event_queue.hpp"
+#include "Interpreter.hpp"
+
+#define TIMEOUT std::chrono::seconds(10)
+
+static std::atomic_bool *running = nullptr;
+
+static bool within_timeout(std::future<void> &f, const char *name) {
+    if (f.wait_for(TIMEOUT) == std::future_status::ready)
+        return true;
+    std::cerr << name << ": FAIL, still blocked after 10s" << std::endl;
+    std::_Exit(1);
+}
+
+static bool closed_queue_releases_producer() {
+    Event_queue<int> q(2, QUEUE_BLOCK);
+    q.push(1);
+    q.push(2);
+    std::atomic_bool pushed(true);
+    std::future<void> producer = std::async(std::launch::async, [&]() {
+        pushed = q.push(3);
+    });
+    while (q.blocked_producers() == 0)
+        std::this_thread::yield();
+    q.close();
+    within_timeout(producer, "closed_queue_releases_producer");
+    if (pushed || q.push(4)) {
+        std::cerr << "closed_queue_releases_producer: FAIL, push into a full closed queue succeeded" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Asks to quit, then stays busy until the scheduler thread is parked on
+// the full callback queue.
+static void quit_when_blocked(Interpreter &s, Value *) {
+    running->store(false);
+    auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+    while (s.callback_queue.blocked_producers() == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+static const Built_in quit_built_in = {"quit-when-blocked", 0, {}, quit_when_blocked};
+
+static bool quit_with_full_callback_queue() {
+    Interpreter st(2, QUEUE_BLOCK, 16, QUEUE_BLOCK);
+    st.add_built_in(quit_built_in);
+    st.eval("$tick [ quit-when-blocked ] !");
+    Symbol tick = st.symtab.intern("tick");
+    for (int i = 0; i < 10; ++i)
+        st.scheduler.schedule_callback(nullptr, tick, 0);
+
+    std::atomic_bool run(true);
+    running = &run;
+    std::future<void> loop = std::async(std::launch::async, [&]() {
+        st.start(run);
+    });
+    within_timeout(loop, "quit_with_full_callback_queue");
+    running = nullptr;
+    return true;
+}
+
+int main() {
+    bool ok = closed_queue_releases_producer();
+    ok = quit_with_full_callback_queue() && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}